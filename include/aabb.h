@@ -6,6 +6,20 @@
 #include "interval.h"
 #include "ray.h"
 
+// Ray data shared by every box test of one traversal, so the reciprocal of
+// the direction and its signs are computed once per ray instead of per box.
+struct SlabRay
+{
+    Point3 origin;
+    Vec3 inv_direction;
+    int direction_is_negative[3];
+
+    explicit SlabRay(const Ray &r)
+        : origin(r.origin),
+          inv_direction(one_f / r.direction.x, one_f / r.direction.y, one_f / r.direction.z),
+          direction_is_negative{r.direction.x < 0, r.direction.y < 0, r.direction.z < 0} {}
+};
+
 struct AABB
 {
     Interval x;
@@ -34,6 +48,23 @@ struct AABB
         return true;
     }
 
+    bool hit(const SlabRay &r, Interval t_range) const
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            const Interval &slab = axis(i);
+            FloatType near = r.direction_is_negative[i] ? slab.max : slab.min;
+            FloatType far = r.direction_is_negative[i] ? slab.min : slab.max;
+            FloatType t0 = (near - r.origin[i]) * r.inv_direction[i];
+            FloatType t1 = (far - r.origin[i]) * r.inv_direction[i];
+            t_range.min = t0 > t_range.min ? t0 : t_range.min;
+            t_range.max = t1 < t_range.max ? t1 : t_range.max;
+            if (t_range.max <= t_range.min)
+                return false;
+        }
+        return true;
+    }
+
     static AABB surrounding_box(const AABB &box0, const AABB &box1)
     {
         return AABB(
@@ -42,6 +73,76 @@ struct AABB
             Interval(std::fmin(box0.z.min, box1.z.min), std::fmax(box0.z.max, box1.z.max)));
     }
 
+    // Overlap of two boxes; empty when they are disjoint.
+    static AABB intersection(const AABB &box0, const AABB &box1)
+    {
+        return AABB(
+            Interval(std::fmax(box0.x.min, box1.x.min), std::fmin(box0.x.max, box1.x.max)),
+            Interval(std::fmax(box0.y.min, box1.y.min), std::fmin(box0.y.max, box1.y.max)),
+            Interval(std::fmax(box0.z.min, box1.z.min), std::fmin(box0.z.max, box1.z.max)));
+    }
+
+    bool is_empty() const
+    {
+        return x.min > x.max || y.min > y.max || z.min > z.max;
+    }
+
+    // Bounds of the part of the convex planar polygon `vertices` that lies
+    // inside `clip`, or an empty box when there is none. Used to tighten the
+    // boxes of primitive fragments created by spatial splits.
+    static AABB clip_polygon(const Point3 *vertices, int vertex_count, const AABB &clip)
+    {
+        // Each of the six planes adds at most one vertex.
+        constexpr int max_vertices = 16;
+        FloatType polygon[max_vertices][3];
+        FloatType clipped[max_vertices][3];
+        int count = std::min(vertex_count, max_vertices - 6);
+        for (int i = 0; i < count; ++i)
+        {
+            for (int a = 0; a < 3; ++a)
+                polygon[i][a] = vertices[i][a];
+        }
+
+        for (int a = 0; a < 3 && count > 0; ++a)
+        {
+            for (int side = 0; side < 2 && count > 0; ++side)
+            {
+                // Keep the points with sign * (p[a] - plane) <= 0.
+                FloatType plane = side == 0 ? clip.axis(a).min : clip.axis(a).max;
+                FloatType sign = side == 0 ? -one_f : one_f;
+                int clipped_count = 0;
+                for (int i = 0; i < count; ++i)
+                {
+                    const FloatType *p = polygon[i];
+                    const FloatType *q = polygon[(i + 1) % count];
+                    FloatType dp = sign * (p[a] - plane);
+                    FloatType dq = sign * (q[a] - plane);
+                    if (dp <= zero_f)
+                        std::copy(p, p + 3, clipped[clipped_count++]);
+                    if ((dp < zero_f && dq > zero_f) || (dp > zero_f && dq < zero_f))
+                    {
+                        FloatType t = dp / (dp - dq);
+                        FloatType *crossing = clipped[clipped_count++];
+                        for (int k = 0; k < 3; ++k)
+                            crossing[k] = p[k] + t * (q[k] - p[k]);
+                        crossing[a] = plane; // exactly on the plane despite rounding
+                    }
+                }
+                count = clipped_count;
+                for (int i = 0; i < count; ++i)
+                    std::copy(clipped[i], clipped[i] + 3, polygon[i]);
+            }
+        }
+
+        AABB box = empty();
+        for (int i = 0; i < count; ++i)
+        {
+            Point3 p(polygon[i][0], polygon[i][1], polygon[i][2]);
+            box = surrounding_box(box, AABB(p, p));
+        }
+        return box;
+    }
+
     const Interval& axis(int n) const
     {
         if (n == 0) return x;
@@ -49,6 +150,22 @@ struct AABB
         return z;
     }
 
+    Point3 centroid() const
+    {
+        return Point3(
+            static_cast<FloatType>(0.5) * (x.min + x.max),
+            static_cast<FloatType>(0.5) * (y.min + y.max),
+            static_cast<FloatType>(0.5) * (z.min + z.max));
+    }
+
+    FloatType surface_area() const
+    {
+        FloatType x_extent = x.max - x.min;
+        FloatType y_extent = y.max - y.min;
+        FloatType z_extent = z.max - z.min;
+        return static_cast<FloatType>(2.0) * (x_extent * y_extent + y_extent * z_extent + z_extent * x_extent);
+    }
+
     int longest_axis() const
     {
         FloatType x_extent = x.max - x.min;
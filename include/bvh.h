@@ -1,102 +1,1754 @@
 #pragma once
 
 #include <algorithm>
+#include <bit>
+#include <cstdint>
 #include <memory>
+#include <utility>
 #include <vector>
 
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/parallel_sort.h>
+
 #include "hittable.h"
-#include "rand_utils.h"
+#include "primitive_table.h"
+#include "ray_packet.h"
+#include "ray_stats.h"
+
+enum class BVHBuilder
+{
+    Median, // sort on the longest axis and split at the median
+    SAH,    // binned surface area heuristic
+    SBVH,   // binned SAH that may also split Triangle and Quad references at spatial planes
+    LBVH,   // linear build over radix-sorted Morton codes of the centroids, for fast previews
+};
+
+struct BVHBuildOptions
+{
+    BVHBuilder builder = BVHBuilder::Median;
+    int sah_bins = 16;      // centroid bins evaluated per axis by the SAH builder
+    int max_leaf_size = 4;  // the SAH builder never creates larger leaves
+    int leaf_width = 1;     // primitives a leaf tests at the cost of one, for primitives that test a leaf with SIMD
+    bool parallel = true;   // build on the TBB runtime; the result is identical to the serial build
+    bool motion_bounds = true; // keep shutter open and close bounds per node when primitives move
+    FloatType sbvh_split_budget = static_cast<FloatType>(0.3); // extra references spatial splits may add, as a fraction of the primitive count
+    FloatType refit_cost_ratio = static_cast<FloatType>(1.5);  // refit asks for a rebuild once the SAH cost grows past this multiple of the built cost
+    int morton_bits = 30;   // Morton code length of the LBVH builder, 30 or 63
+    int treelet_passes = 0; // agglomerative treelet restructuring passes after an LBVH build
+};
 
 struct BVH : public Hittable
 {
+    // Nodes are laid out depth-first in one contiguous array. An interior
+    // node's first child immediately follows it and `offset` holds the index
+    // of the second child. A leaf references `count` primitives starting at
+    // `primitives[offset]`.
     struct Node
     {
-        std::shared_ptr<Hittable> object;
-        std::shared_ptr<Node> left;
-        std::shared_ptr<Node> right;
         AABB box;
+        std::uint32_t offset;
+        std::uint16_t count; // 0 for interior nodes
+        std::uint8_t axis;   // split axis of interior nodes
+        std::uint8_t pad;
+
+        bool is_leaf() const { return count > 0; }
+    };
+
+    // Relative costs used by the surface area heuristic.
+    static constexpr FloatType traversal_cost = static_cast<FloatType>(0.125);
+    static constexpr FloatType intersection_cost = one_f;
+
+    // Subtrees smaller than this are built on the calling thread.
+    static constexpr size_t parallel_subtree_threshold = 1024;
+    // Ranges at least this large also reduce bounds, bin and partition in parallel.
+    static constexpr size_t parallel_range_threshold = 64 * 1024;
+    // Bound on the tree depth, which sizes the traversal stack.
+    static constexpr int max_depth = 64;
+    // The SBVH builder only looks for spatial splits where the children of
+    // the best object split overlap by more than this fraction of the root area.
+    static constexpr FloatType spatial_split_alpha = static_cast<FloatType>(1e-5);
+
+    // Node bounds at the start and end of the shutter interval. Boxes of
+    // linearly moving primitives are interpolated by ray time, which stays
+    // conservative for the unions stored in interior nodes.
+    struct MotionBox
+    {
+        AABB start;
+        AABB end;
+
+        AABB at(FloatType s) const
+        {
+            return AABB(
+                Interval(start.x.min + s * (end.x.min - start.x.min), start.x.max + s * (end.x.max - start.x.max)),
+                Interval(start.y.min + s * (end.y.min - start.y.min), start.y.max + s * (end.y.max - start.y.max)),
+                Interval(start.z.min + s * (end.z.min - start.z.min), start.z.max + s * (end.z.max - start.z.max)));
+        }
 
-        Node() : object(nullptr), left(nullptr), right(nullptr), box(AABB::empty()) {}
+        // Slab test against the box at shutter fraction `s`, interpolating
+        // one axis at a time so a miss on the first axis skips the rest.
+        bool hit(const SlabRay &r, FloatType s, Interval t_range) const
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                const Interval &a = start.axis(i);
+                const Interval &b = end.axis(i);
+                FloatType lo = a.min + s * (b.min - a.min);
+                FloatType hi = a.max + s * (b.max - a.max);
+                FloatType near = r.direction_is_negative[i] ? hi : lo;
+                FloatType far = r.direction_is_negative[i] ? lo : hi;
+                FloatType t0 = (near - r.origin[i]) * r.inv_direction[i];
+                FloatType t1 = (far - r.origin[i]) * r.inv_direction[i];
+                t_range.min = t0 > t_range.min ? t0 : t_range.min;
+                t_range.max = t1 < t_range.max ? t1 : t_range.max;
+                if (t_range.max <= t_range.min)
+                    return false;
+            }
+            return true;
+        }
     };
 
-    std::shared_ptr<Node> root;
+    std::vector<Node> nodes;
+    std::vector<std::shared_ptr<Hittable>> primitives;
+    std::vector<std::uint32_t> indices; // source index of every leaf reference, in leaf order
+    // Copies of `primitives` grouped by type, which the leaves are tested
+    // against. Shared with the wide layouts collapsed from this tree. Empty,
+    // never null, for an empty scene or a tree over bare boxes.
+    std::shared_ptr<const PrimitiveTable> table = std::make_shared<const PrimitiveTable>();
+    // Parallel to `nodes`; empty unless some primitive moves during the
+    // shutter interval. `Node::box` then holds the swept bounds.
+    std::vector<MotionBox> motion_boxes;
+    BVHBuildOptions options;
+    FloatType time0 = zero_f;
+    FloatType time1 = zero_f;
+    FloatType build_cost = zero_f; // SAH cost right after the last full build
+
+    BVH(const std::vector<std::shared_ptr<Hittable>> &objects, size_t start, size_t end, FloatType time0, FloatType time1,
+        const BVHBuildOptions &options = BVHBuildOptions())
+        : options(options), time0(time0), time1(time1)
+    {
+        if (start >= end)
+            return;
+
+        size_t count = end - start;
+        std::vector<MotionBox> primitive_boxes(count, MotionBox{AABB::empty(), AABB::empty()});
+        for_each_index(count, [&](size_t i)
+        {
+            const auto &object = objects[start + i];
+            primitive_boxes[i] = {object->bounding_box_at(time0), object->bounding_box_at(time1)};
+        });
+        build_tree(objects, start, primitive_boxes, options.motion_bounds && time1 > time0);
+        group_leaves_by_type(objects, start, count);
+
+        // Leaves reference contiguous ranges of the partitioned build order.
+        primitives.resize(indices.size());
+        for_each_index(indices.size(), [&](size_t i)
+        {
+            primitives[i] = objects[indices[i]];
+        });
+        table = std::make_shared<const PrimitiveTable>(primitives);
+    }
+
+    BVH(const std::vector<std::shared_ptr<Hittable>> &objects, FloatType time0, FloatType time1,
+        const BVHBuildOptions &options = BVHBuildOptions())
+        : BVH(objects, 0, objects.size(), time0, time1, options) {}
+
+    // Builds over bare boxes given at the start and end of the shutter
+    // interval, such as the instances of a two-level structure. `primitives`
+    // and `table` stay empty and callers resolve leaves through `indices`
+    // with `traverse`; `hit`, `occluded` and `hit_packet` report no hits.
+    BVH(const std::vector<MotionBox> &boxes, FloatType time0, FloatType time1,
+        const BVHBuildOptions &options = BVHBuildOptions())
+        : options(options), time0(time0), time1(time1)
+    {
+        if (boxes.empty())
+            return;
+        build_tree({}, 0, boxes, options.motion_bounds && time1 > time0);
+    }
 
-    BVH(std::vector<std::shared_ptr<Hittable>> &objects, size_t start, size_t end, FloatType time1)
+    // Recomputes the node bounds bottom-up from the primitive bounds over a
+    // new shutter interval, keeping the topology, as for the next frame of an
+    // animation. Returns false once the SAH cost has grown past
+    // `options.refit_cost_ratio` times the built cost, meaning a full rebuild
+    // is due. Spatial-split fragments are refitted with whole primitive boxes.
+    bool refit(FloatType new_time0, FloatType new_time1)
     {
-        if (start >= end) {
-            root = nullptr;
-        } else {
-            root = build(objects, start, end, time1);
+        time0 = new_time0;
+        time1 = new_time1;
+        std::vector<MotionBox> leaf_boxes(primitives.size(), MotionBox{AABB::empty(), AABB::empty()});
+        for_each_index(primitives.size(), [&](size_t i)
+        {
+            leaf_boxes[i] = {primitives[i]->bounding_box_at(time0), primitives[i]->bounding_box_at(time1)};
+        });
+        return refit_leaves(leaf_boxes, options.motion_bounds && time1 > time0);
+    }
+
+    // The distinct primitives in source order, without spatial-split
+    // duplicates, e.g. to rebuild the tree from scratch.
+    std::vector<std::shared_ptr<Hittable>> source_objects() const
+    {
+        std::vector<std::pair<std::uint32_t, std::shared_ptr<Hittable>>> by_index(primitives.size());
+        for (size_t i = 0; i < primitives.size(); ++i)
+            by_index[i] = {indices[i], primitives[i]};
+        std::sort(by_index.begin(), by_index.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        std::vector<std::shared_ptr<Hittable>> objects;
+        for (size_t i = 0; i < by_index.size(); ++i)
+        {
+            if (i == 0 || by_index[i].first != by_index[i - 1].first)
+                objects.push_back(by_index[i].second);
         }
+        return objects;
     }
 
-    BVH(std::vector<std::shared_ptr<Hittable>> &objects, FloatType time1)
-        : BVH(objects, 0, objects.size(), time1) {}
+    // Refit of a tree built over bare boxes, given in source order.
+    bool refit(const std::vector<MotionBox> &boxes, FloatType new_time0, FloatType new_time1)
+    {
+        time0 = new_time0;
+        time1 = new_time1;
+        std::vector<MotionBox> leaf_boxes(indices.size(), MotionBox{AABB::empty(), AABB::empty()});
+        for_each_index(indices.size(), [&](size_t i)
+        {
+            leaf_boxes[i] = boxes[indices[i]];
+        });
+        return refit_leaves(leaf_boxes, options.motion_bounds && time1 > time0);
+    }
 
     bool hit(const Ray &r, Interval t_range, HitRecord &rec) const override
     {
-        return hit_node(root.get(), r, t_range, rec);
+        if (table->empty())
+            return false;
+        const PrimitiveTable &leaves = *table;
+        PrimitiveHit nearest;
+        if (!traverse(r, t_range, rec, [&](std::uint32_t reference, const Interval &range, HitRecord &record)
+        {
+            return leaves.intersect(reference, r, range, nearest, record);
+        }))
+            return false;
+        leaves.compute_surface_interaction(r, nearest, rec);
+        return true;
+    }
+
+    bool occluded(const Ray &r, Interval t_range) const override
+    {
+        if (table->empty())
+            return false;
+        const PrimitiveTable &leaves = *table;
+        return traverse_any(r, t_range, [&](std::uint32_t reference, const Interval &range)
+        {
+            return leaves.occluded(reference, r, range);
+        });
+    }
+
+    // Visits the leaves `r` reaches within `t_range`, calling
+    // `hit_reference(reference, t_range, rec)` for every reference stored
+    // there, where `reference` is a position in leaf order. Each reported hit
+    // shrinks `t_range`.
+    template <typename HitReference>
+    bool traverse(const Ray &r, Interval t_range, HitRecord &rec, const HitReference &hit_reference) const
+    {
+        return traverse_leaves(r, t_range, rec, [&](std::uint32_t first, std::uint32_t count, Interval range, HitRecord &record)
+        {
+            int hits = 0;
+            for (std::uint32_t i = 0; i < count; ++i)
+            {
+                if (hit_reference(first + i, range, record))
+                {
+                    ++hits;
+                    range.max = record.t;
+                }
+            }
+            return hits;
+        });
+    }
+
+    // Like `traverse`, but hands each leaf over whole as
+    // `hit_leaf(first, count, t_range, rec)`, which tests references
+    // `first` to `first + count - 1` and returns how many hits it recorded,
+    // leaving the nearest in `rec`. For primitives that test a leaf at once.
+    template <typename HitLeaf>
+    bool traverse_leaves(const Ray &r, Interval t_range, HitRecord &rec, const HitLeaf &hit_leaf) const
+    {
+        if (nodes.empty())
+            return false;
+        if (motion_boxes.empty())
+            return traverse_nodes<false, false>(r, t_range, rec, hit_leaf);
+        return traverse_nodes<true, false>(r, t_range, rec, hit_leaf);
+    }
+
+    // Any-hit counterpart of `traverse`: returns true as soon as
+    // `occluded_reference(reference, t_range)` does for some reference.
+    template <typename OccludedReference>
+    bool traverse_any(const Ray &r, Interval t_range, const OccludedReference &occluded_reference) const
+    {
+        return traverse_leaves_any(r, t_range, [&](std::uint32_t first, std::uint32_t count, const Interval &range)
+        {
+            for (std::uint32_t i = 0; i < count; ++i)
+            {
+                if (occluded_reference(first + i, range))
+                    return true;
+            }
+            return false;
+        });
+    }
+
+    // Any-hit counterpart of `traverse_leaves`, with
+    // `occluded_leaf(first, count, t_range)`.
+    template <typename OccludedLeaf>
+    bool traverse_leaves_any(const Ray &r, Interval t_range, const OccludedLeaf &occluded_leaf) const
+    {
+        if (nodes.empty())
+            return false;
+        auto unused = HitRecord::uninitialized();
+        auto hit_leaf = [&](std::uint32_t first, std::uint32_t count, const Interval &range, HitRecord &)
+        {
+            return occluded_leaf(first, count, range) ? 1 : 0;
+        };
+        if (motion_boxes.empty())
+            return traverse_nodes<false, true>(r, t_range, unused, hit_leaf);
+        return traverse_nodes<true, true>(r, t_range, unused, hit_leaf);
+    }
+
+    std::uint32_t hit_packet(const Ray *rays, int count, Interval t_range, HitRecord *hit_records) const override
+    {
+        if (table->empty())
+            return 0;
+        RayPacket packet(rays, count, t_range);
+        if (motion_boxes.empty())
+            return traverse_packet<false>(rays, packet, hit_records);
+        packet.set_shutter(time0, time1);
+        return traverse_packet<true>(rays, packet, hit_records);
+    }
+
+    AABB bounding_box() const override { return nodes.empty() ? AABB::empty() : nodes[0].box; }
+    AABB bounding_box(FloatType) const override { return nodes.empty() ? AABB::empty() : nodes[0].box; }
+
+    AABB bounding_box_at(FloatType time) const override
+    {
+        if (motion_boxes.empty())
+            return bounding_box();
+        return motion_boxes[0].at(shutter_fraction(time));
+    }
+
+    // Checks a tree read from a file before it is traversed: walked from the
+    // root, every node is reached once and within `max_depth` levels, which
+    // bounds the traversal stack, every child link and leaf range stays
+    // inside the node and index arrays, every split axis is 0, 1 or 2, and
+    // every index is below `primitive_count`.
+    bool is_well_formed(size_t primitive_count) const
+    {
+        if (!motion_boxes.empty() && motion_boxes.size() != nodes.size())
+            return false;
+        for (std::uint32_t index : indices)
+        {
+            if (index >= primitive_count)
+                return false;
+        }
+        if (nodes.empty())
+            return true;
+
+        struct Entry
+        {
+            std::uint32_t index;
+            int depth;
+        };
+        std::vector<char> reached(nodes.size(), 0);
+        std::vector<Entry> stack{{0, 0}};
+        while (!stack.empty())
+        {
+            const Entry entry = stack.back();
+            stack.pop_back();
+            if (entry.depth > max_depth || reached[entry.index])
+                return false;
+            reached[entry.index] = 1;
+
+            const Node &node = nodes[entry.index];
+            if (node.is_leaf())
+            {
+                if (size_t(node.offset) + node.count > indices.size())
+                    return false;
+                continue;
+            }
+            // An interior node has a count of 0 and two children after it.
+            if (node.axis > 2 || size_t(entry.index) + 1 >= nodes.size() || node.offset <= entry.index + 1 || node.offset >= nodes.size())
+                return false;
+            stack.push_back({entry.index + 1, entry.depth + 1});
+            stack.push_back({node.offset, entry.depth + 1});
+        }
+        return true;
     }
 
-    AABB bounding_box() const override { return root ? root->box : AABB::empty(); }
-    AABB bounding_box(FloatType) const override { return root ? root->box : AABB::empty(); }
+    // Bytes taken by the node and motion box arrays.
+    size_t node_memory() const { return nodes.size() * sizeof(Node) + motion_boxes.size() * sizeof(MotionBox); }
+
+    // Expected cost of tracing a random ray through the tree, relative to a
+    // single primitive intersection.
+    FloatType sah_cost() const
+    {
+        if (nodes.empty())
+            return zero_f;
+        FloatType root_area = nodes[0].box.surface_area();
+        if (root_area <= zero_f)
+            return zero_f;
+        FloatType cost = zero_f;
+        for (const auto &node : nodes)
+        {
+            FloatType node_cost = node.is_leaf() ? leaf_cost(node.count) : traversal_cost;
+            cost += node.box.surface_area() / root_area * node_cost;
+        }
+        return cost;
+    }
 
 private:
-    static std::shared_ptr<Node> build(std::vector<std::shared_ptr<Hittable>> &objects, size_t start, size_t end, FloatType time1)
+    struct BuildPrimitive
+    {
+        AABB box = AABB::empty();
+        Point3 centroid = Point3::zero();
+        std::uint32_t index = 0; // index into the source object list
+    };
+
+    // Temporary pointer tree produced by the recursive build and flattened
+    // into `nodes` once its size is known.
+    struct BuildNode
+    {
+        AABB box = AABB::empty();
+        size_t start = 0;
+        size_t count = 0;      // primitives referenced by a leaf, 0 for interior nodes
+        int axis = 0;
+        size_t node_count = 1; // nodes in this subtree
+        int height = 0;        // levels below this node, only kept by the LBVH builder
+        std::unique_ptr<BuildNode> children[2];
+        std::vector<BuildPrimitive> references; // leaf references of an SBVH build until laid out
+    };
+
+    struct Bin
+    {
+        AABB box = AABB::empty();
+        size_t count = 0;
+    };
+
+    // Builds the tree over `primitive_boxes`, whose entries have source
+    // indices from `start`, and fills `nodes`, `indices` and `motion_boxes`.
+    // `objects` lets the SBVH builder clip primitives and may be empty.
+    void build_tree(const std::vector<std::shared_ptr<Hittable>> &objects, size_t start, const std::vector<MotionBox> &primitive_boxes, bool track_motion)
+    {
+        size_t count = primitive_boxes.size();
+        std::vector<BuildPrimitive> build_primitives(count);
+        for_each_index(count, [&](size_t i)
+        {
+            AABB box = AABB::surrounding_box(primitive_boxes[i].start, primitive_boxes[i].end);
+            build_primitives[i] = {box, box.centroid(), static_cast<std::uint32_t>(start + i)};
+        });
+
+        std::unique_ptr<BuildNode> root;
+        if (options.builder == BVHBuilder::SBVH)
+        {
+            // Spatial splits duplicate references, so every node owns its
+            // references and the leaves are concatenated afterwards.
+            FloatType root_area = reduce_bounds(build_primitives, 0, count, [](const BuildPrimitive &p) { return p.box; }).surface_area();
+            size_t budget = static_cast<size_t>(std::max(options.sbvh_split_budget, zero_f) * count);
+            root = build_spatial(objects, std::move(build_primitives), root_area, budget, 0);
+            build_primitives.clear();
+            lay_out_leaves(*root, build_primitives);
+        }
+        else if (options.builder == BVHBuilder::LBVH)
+        {
+            root = build_linear(build_primitives);
+            for (int pass = 0; pass < options.treelet_passes; ++pass)
+                optimize_treelets(*root, 0);
+        }
+        else
+        {
+            std::vector<BuildPrimitive> scratch(count);
+            root = build(build_primitives, scratch, 0, count, 0);
+        }
+
+        nodes.resize(root->node_count, Node{AABB::empty(), 0, 0, 0, 0});
+        flatten(*root, 0);
+
+        indices.resize(build_primitives.size());
+        for_each_index(indices.size(), [&](size_t i)
+        {
+            indices[i] = build_primitives[i].index;
+        });
+
+        if (track_motion && std::any_of(primitive_boxes.begin(), primitive_boxes.end(), [](const MotionBox &m) { return is_moving(m); }))
+        {
+            std::vector<MotionBox> leaf_order(indices.size(), MotionBox{AABB::empty(), AABB::empty()});
+            for_each_index(indices.size(), [&](size_t i)
+            {
+                leaf_order[i] = primitive_boxes[indices[i] - start];
+            });
+            motion_boxes.resize(nodes.size(), MotionBox{AABB::empty(), AABB::empty()});
+            compute_motion_boxes(leaf_order, 0);
+        }
+        build_cost = sah_cost();
+    }
+
+    // Orders the references of every leaf by primitive type, so a leaf
+    // tests one run per type and the table stores each run contiguously.
+    void group_leaves_by_type(const std::vector<std::shared_ptr<Hittable>> &objects, size_t start, size_t count)
+    {
+        std::vector<PrimitiveType> types(count);
+        for_each_index(count, [&](size_t i)
+        {
+            types[i] = PrimitiveTable::type_of(*objects[start + i]);
+        });
+        for_each_index(nodes.size(), [&](size_t i)
+        {
+            const Node &node = nodes[i];
+            if (node.is_leaf())
+            {
+                std::stable_sort(indices.begin() + node.offset, indices.begin() + node.offset + node.count,
+                                 [&](std::uint32_t a, std::uint32_t b) { return types[a - start] < types[b - start]; });
+            }
+        });
+    }
+
+    bool refit_leaves(const std::vector<MotionBox> &leaf_boxes, bool track_motion)
+    {
+        if (nodes.empty())
+            return true;
+        motion_boxes.clear();
+        if (track_motion && std::any_of(leaf_boxes.begin(), leaf_boxes.end(), [](const MotionBox &m) { return is_moving(m); }))
+            motion_boxes.resize(nodes.size(), MotionBox{AABB::empty(), AABB::empty()});
+        refit_node(leaf_boxes, 0);
+        return sah_cost() <= options.refit_cost_ratio * build_cost;
+    }
+
+    // Sets the swept and, when tracked, the per-time bounds of a subtree.
+    void refit_node(const std::vector<MotionBox> &leaf_boxes, size_t index)
+    {
+        Node &node = nodes[index];
+        MotionBox motion{AABB::empty(), AABB::empty()};
+        if (node.is_leaf())
+        {
+            for (std::uint32_t i = 0; i < node.count; ++i)
+            {
+                motion.start = AABB::surrounding_box(motion.start, leaf_boxes[node.offset + i].start);
+                motion.end = AABB::surrounding_box(motion.end, leaf_boxes[node.offset + i].end);
+            }
+        }
+        else
+        {
+            size_t left_nodes = node.offset - index - 1;
+            if (options.parallel && left_nodes >= parallel_subtree_threshold)
+            {
+                tbb::parallel_invoke(
+                    [&] { refit_node(leaf_boxes, index + 1); },
+                    [&] { refit_node(leaf_boxes, node.offset); });
+            }
+            else
+            {
+                refit_node(leaf_boxes, index + 1);
+                refit_node(leaf_boxes, node.offset);
+            }
+            const Node &left = nodes[index + 1];
+            const Node &right = nodes[node.offset];
+            if (motion_boxes.empty())
+            {
+                node.box = AABB::surrounding_box(left.box, right.box);
+                return;
+            }
+            motion.start = AABB::surrounding_box(motion_boxes[index + 1].start, motion_boxes[node.offset].start);
+            motion.end = AABB::surrounding_box(motion_boxes[index + 1].end, motion_boxes[node.offset].end);
+        }
+        node.box = AABB::surrounding_box(motion.start, motion.end);
+        if (!motion_boxes.empty())
+            motion_boxes[index] = motion;
+    }
+
+    // Best binned object split of a range. `cost` sums count times surface
+    // area over both sides.
+    struct ObjectSplit
+    {
+        FloatType cost = infinity_f;
+        int axis = -1;
+        int bin = 0;          // first bin of the right side
+        FloatType min = zero_f;   // centroid binning origin on `axis`
+        FloatType scale = zero_f; // centroid bins per unit length on `axis`
+        AABB left_box = AABB::empty();
+        AABB right_box = AABB::empty();
+    };
+
+    // Best spatial split of a node, with the same cost measure.
+    struct SpatialSplit
+    {
+        FloatType cost = infinity_f;
+        int axis = -1;
+        FloatType position = zero_f;
+        size_t duplicates = 0; // references straddling the plane
+    };
+
+    struct SpatialBin
+    {
+        AABB box = AABB::empty(); // bounds of the reference fragments inside the bin
+        size_t entries = 0;       // references whose box starts in the bin
+        size_t exits = 0;         // references whose box ends in the bin
+    };
+
+    bool parallel_range(size_t start, size_t end) const
+    {
+        return options.parallel && end - start >= parallel_range_threshold;
+    }
+
+    template <typename Function>
+    void for_each_index(size_t count, const Function &function) const
+    {
+        if (options.parallel)
+        {
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, count, 1024), [&](const tbb::blocked_range<size_t> &range)
+            {
+                for (size_t i = range.begin(); i != range.end(); ++i)
+                    function(i);
+            });
+        }
+        else
+        {
+            for (size_t i = 0; i < count; ++i)
+                function(i);
+        }
+    }
+
+    std::unique_ptr<BuildNode> build(std::vector<BuildPrimitive> &build_primitives, std::vector<BuildPrimitive> &scratch, size_t start, size_t end, int depth) const
+    {
+        size_t object_span = end - start;
+        auto node = std::make_unique<BuildNode>();
+        node->box = reduce_bounds(build_primitives, start, end, [](const BuildPrimitive &p) { return p.box; });
+
+        int axis = 0;
+        size_t mid = start;
+        if (object_span > 1)
+        {
+            // Median splits past half the depth budget keep degenerate SAH
+            // chains within max_depth, since they halve the range per level.
+            bool deep = depth >= max_depth / 2;
+            if (options.builder == BVHBuilder::SAH && !deep)
+                mid = partition_sah(build_primitives, scratch, start, end, node->box, axis);
+            else if (options.builder == BVHBuilder::SAH && object_span <= static_cast<size_t>(options.max_leaf_size))
+                mid = start;
+            else
+                mid = partition_median(build_primitives, start, end, node->box, axis);
+        }
+
+        if (mid == start)
+        {
+            node->start = start;
+            node->count = object_span;
+            return node;
+        }
+
+        node->axis = axis;
+        if (options.parallel && object_span >= parallel_subtree_threshold)
+        {
+            tbb::parallel_invoke(
+                [&] { node->children[0] = build(build_primitives, scratch, start, mid, depth + 1); },
+                [&] { node->children[1] = build(build_primitives, scratch, mid, end, depth + 1); });
+        }
+        else
+        {
+            node->children[0] = build(build_primitives, scratch, start, mid, depth + 1);
+            node->children[1] = build(build_primitives, scratch, mid, end, depth + 1);
+        }
+        node->node_count = 1 + node->children[0]->node_count + node->children[1]->node_count;
+        return node;
+    }
+
+    // Linear BVH: primitives are sorted along a Morton curve through their
+    // centroids, after which every subtree covers a contiguous range of the
+    // sorted order and splits where the highest differing code bit flips.
+    std::unique_ptr<BuildNode> build_linear(std::vector<BuildPrimitive> &build_primitives) const
+    {
+        size_t count = build_primitives.size();
+        AABB centroid_box = reduce_bounds(build_primitives, 0, count, [](const BuildPrimitive &p) { return AABB(p.centroid, p.centroid); });
+        int axis_bits = options.morton_bits > 30 ? 21 : 10;
+        FloatType cells = static_cast<FloatType>((std::uint64_t(1) << axis_bits) - 1);
+
+        std::vector<std::uint64_t> codes(count);
+        std::vector<std::uint32_t> order(count);
+        for_each_index(count, [&](size_t i)
+        {
+            std::uint64_t code = 0;
+            for (int a = 0; a < 3; ++a)
+            {
+                const Interval &extent = centroid_box.axis(a);
+                FloatType size = extent.max - extent.min;
+                FloatType position = size > zero_f ? (build_primitives[i].centroid[a] - extent.min) / size * cells : zero_f;
+                code |= spread_bits(static_cast<std::uint64_t>(std::clamp(position, zero_f, cells))) << (2 - a);
+            }
+            codes[i] = code;
+            order[i] = static_cast<std::uint32_t>(i);
+        });
+        radix_sort(codes, order, 3 * axis_bits);
+
+        std::vector<BuildPrimitive> sorted(count);
+        for_each_index(count, [&](size_t i)
+        {
+            sorted[i] = build_primitives[order[i]];
+        });
+        build_primitives.swap(sorted);
+        return emit_linear(build_primitives, codes, 0, count, 0);
+    }
+
+    // Spreads the low 21 bits of `v` to every third bit, so three spread
+    // coordinates interleave into one Morton code.
+    static std::uint64_t spread_bits(std::uint64_t v)
+    {
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffffull;
+        v = (v | v << 16) & 0x1f0000ff0000ffull;
+        v = (v | v << 8) & 0x100f00f00f00f00full;
+        v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+        v = (v | v << 2) & 0x1249249249249249ull;
+        return v;
+    }
+
+    // Stable LSD radix sort of `keys` with `values`, eight bits per pass.
+    // Blocks count and scatter their digits in parallel; stability makes the
+    // result independent of the block count.
+    void radix_sort(std::vector<std::uint64_t> &keys, std::vector<std::uint32_t> &values, int key_bits) const
+    {
+        constexpr size_t block_size = 16 * 1024;
+        constexpr size_t radix = 256;
+        size_t count = keys.size();
+        size_t block_count = std::max<size_t>((count + block_size - 1) / block_size, 1);
+        std::vector<std::uint64_t> key_scratch(count);
+        std::vector<std::uint32_t> value_scratch(count);
+        std::vector<size_t> offsets(block_count * radix);
+
+        auto for_each_block = [&](const auto &function)
+        {
+            if (parallel_range(0, count))
+                tbb::parallel_for(size_t(0), block_count, function);
+            else
+                for (size_t b = 0; b < block_count; ++b)
+                    function(b);
+        };
+
+        for (int shift = 0; shift < key_bits; shift += 8)
+        {
+            std::fill(offsets.begin(), offsets.end(), 0);
+            for_each_block([&](size_t b)
+            {
+                size_t block_end = std::min((b + 1) * block_size, count);
+                for (size_t i = b * block_size; i < block_end; ++i)
+                    ++offsets[b * radix + ((keys[i] >> shift) & (radix - 1))];
+            });
+
+            // Digit-major prefix sum, so each block scatters its share of a
+            // digit right after the blocks before it.
+            size_t sum = 0;
+            for (size_t digit = 0; digit < radix; ++digit)
+            {
+                for (size_t b = 0; b < block_count; ++b)
+                {
+                    size_t digit_count = offsets[b * radix + digit];
+                    offsets[b * radix + digit] = sum;
+                    sum += digit_count;
+                }
+            }
+
+            for_each_block([&](size_t b)
+            {
+                size_t block_end = std::min((b + 1) * block_size, count);
+                for (size_t i = b * block_size; i < block_end; ++i)
+                {
+                    size_t destination = offsets[b * radix + ((keys[i] >> shift) & (radix - 1))]++;
+                    key_scratch[destination] = keys[i];
+                    value_scratch[destination] = values[i];
+                }
+            });
+            keys.swap(key_scratch);
+            values.swap(value_scratch);
+        }
+    }
+
+    std::unique_ptr<BuildNode> emit_linear(const std::vector<BuildPrimitive> &build_primitives, const std::vector<std::uint64_t> &codes,
+                                           size_t start, size_t end, int depth) const
     {
+        auto node = std::make_unique<BuildNode>();
         size_t object_span = end - start;
-        
-        if (object_span == 0) {
-            return nullptr;
+        if (object_span == 1)
+        {
+            node->box = build_primitives[start].box;
+            node->start = start;
+            node->count = 1;
+            return node;
+        }
+
+        // All codes in the range share the bits above the highest one where
+        // its first and last codes differ; the split is where it turns to 1.
+        // Equal codes, and ranges past half the depth budget, split in the
+        // middle, which keeps the depth within max_depth.
+        std::uint64_t difference = codes[start] ^ codes[end - 1];
+        size_t mid = start + object_span / 2;
+        if (difference != 0 && depth < max_depth / 2)
+        {
+            int bit = 63 - std::countl_zero(difference);
+            mid = std::partition_point(codes.begin() + start, codes.begin() + end,
+                                       [bit](std::uint64_t code) { return ((code >> bit) & 1) == 0; }) - codes.begin();
+        }
+
+        if (options.parallel && object_span >= parallel_subtree_threshold)
+        {
+            tbb::parallel_invoke(
+                [&] { node->children[0] = emit_linear(build_primitives, codes, start, mid, depth + 1); },
+                [&] { node->children[1] = emit_linear(build_primitives, codes, mid, end, depth + 1); });
+        }
+        else
+        {
+            node->children[0] = emit_linear(build_primitives, codes, start, mid, depth + 1);
+            node->children[1] = emit_linear(build_primitives, codes, mid, end, depth + 1);
+        }
+        join_children(*node);
+
+        // Small subtrees become a single leaf when the SAH prefers it.
+        if (object_span <= static_cast<size_t>(options.max_leaf_size) &&
+            leaf_cost(object_span) * node->box.surface_area() <= subtree_cost(*node))
+        {
+            node->children[0].reset();
+            node->children[1].reset();
+            node->start = start;
+            node->count = object_span;
+            node->node_count = 1;
+            node->height = 0;
+        }
+        return node;
+    }
+
+    // Sets the bounds, size and height of an interior node from its children,
+    // and the axis along which they are furthest apart for near-first traversal.
+    static void join_children(BuildNode &node)
+    {
+        const BuildNode &left = *node.children[0];
+        const BuildNode &right = *node.children[1];
+        node.box = AABB::surrounding_box(left.box, right.box);
+        node.node_count = 1 + left.node_count + right.node_count;
+        node.height = 1 + std::max(left.height, right.height);
+        Vec3 separation = right.box.centroid() - left.box.centroid();
+        node.axis = 0;
+        for (int a = 1; a < 3; ++a)
+        {
+            if (std::fabs(separation[a]) > std::fabs(separation[node.axis]))
+                node.axis = a;
         }
-        
-        Node node;
-        
+    }
+
+    // SAH cost of a subtree, scaled by the surface area of its root.
+    FloatType subtree_cost(const BuildNode &node) const
+    {
+        if (node.count > 0)
+            return leaf_cost(node.count) * node.box.surface_area();
+        return traversal_cost * node.box.surface_area() + subtree_cost(*node.children[0]) + subtree_cost(*node.children[1]);
+    }
+
+    // Largest treelet restructured at once; agglomeration is cubic in it.
+    static constexpr int treelet_size = 7;
+
+    // Agglomerative treelet restructuring, bottom-up. Each node grows a
+    // treelet by opening its largest interior descendants, then rebuilds the
+    // treelet's interior by repeatedly merging the pair of subtrees with the
+    // smallest bounding box. The new topology is kept when it lowers the
+    // summed area of the treelet's interior nodes and stays within max_depth.
+    void optimize_treelets(BuildNode &node, int depth) const
+    {
+        if (node.count > 0)
+            return;
+        if (options.parallel && node.node_count >= parallel_subtree_threshold)
+        {
+            tbb::parallel_invoke(
+                [&] { optimize_treelets(*node.children[0], depth + 1); },
+                [&] { optimize_treelets(*node.children[1], depth + 1); });
+        }
+        else
+        {
+            optimize_treelets(*node.children[0], depth + 1);
+            optimize_treelets(*node.children[1], depth + 1);
+        }
+        node.height = 1 + std::max(node.children[0]->height, node.children[1]->height);
+
+        std::vector<BuildNode *> leaves = {node.children[0].get(), node.children[1].get()};
+        std::vector<BuildNode *> opened;
+        while (leaves.size() < treelet_size)
+        {
+            int best = -1;
+            for (int i = 0; i < static_cast<int>(leaves.size()); ++i)
+            {
+                if (leaves[i]->count == 0 && (best < 0 || leaves[i]->box.surface_area() > leaves[best]->box.surface_area()))
+                    best = i;
+            }
+            if (best < 0)
+                break;
+            BuildNode *interior = leaves[best];
+            opened.push_back(interior);
+            leaves[best] = interior->children[0].get();
+            leaves.push_back(interior->children[1].get());
+        }
+        if (opened.empty())
+            return;
+
+        FloatType old_cost = zero_f;
+        for (const BuildNode *interior : opened)
+            old_cost += interior->box.surface_area();
+
+        // Greedy agglomeration over the treelet leaves; clusters index into
+        // `merges` once they are the result of a merge.
+        struct Cluster
+        {
+            AABB box;
+            int height;
+            int leaf;  // index into `leaves`, or -1
+            int merge; // index into `merges`, or -1
+        };
+        std::vector<Cluster> clusters;
+        for (int i = 0; i < static_cast<int>(leaves.size()); ++i)
+            clusters.push_back({leaves[i]->box, leaves[i]->height, i, -1});
+        std::vector<std::pair<Cluster, Cluster>> merges;
+        FloatType new_cost = zero_f;
+        while (clusters.size() > 2)
+        {
+            size_t best_a = 0;
+            size_t best_b = 1;
+            FloatType best_area = infinity_f;
+            for (size_t a = 0; a < clusters.size(); ++a)
+            {
+                for (size_t b = a + 1; b < clusters.size(); ++b)
+                {
+                    FloatType area = AABB::surrounding_box(clusters[a].box, clusters[b].box).surface_area();
+                    if (area < best_area)
+                    {
+                        best_area = area;
+                        best_a = a;
+                        best_b = b;
+                    }
+                }
+            }
+            merges.push_back({clusters[best_a], clusters[best_b]});
+            Cluster merged{AABB::surrounding_box(clusters[best_a].box, clusters[best_b].box),
+                           1 + std::max(clusters[best_a].height, clusters[best_b].height), -1, static_cast<int>(merges.size() - 1)};
+            new_cost += best_area;
+            clusters.erase(clusters.begin() + best_b);
+            clusters[best_a] = merged;
+        }
+        int new_height = 1 + std::max(clusters[0].height, clusters[1].height);
+        if (new_cost >= old_cost || depth + new_height >= max_depth)
+            return;
+
+        // Take ownership of the treelet leaves before the old interior nodes,
+        // which own them, are released.
+        std::vector<std::unique_ptr<BuildNode>> owned(leaves.size());
+        auto detach = [&](std::unique_ptr<BuildNode> &child)
+        {
+            for (size_t i = 0; i < leaves.size(); ++i)
+            {
+                if (child.get() == leaves[i])
+                    owned[i] = std::move(child);
+            }
+        };
+        detach(node.children[0]);
+        detach(node.children[1]);
+        for (BuildNode *interior : opened)
+        {
+            detach(interior->children[0]);
+            detach(interior->children[1]);
+        }
+
+        std::vector<std::unique_ptr<BuildNode>> merged(merges.size());
+        auto take = [&](const Cluster &cluster) -> std::unique_ptr<BuildNode>
+        {
+            return cluster.leaf >= 0 ? std::move(owned[cluster.leaf]) : std::move(merged[cluster.merge]);
+        };
+        for (size_t m = 0; m < merges.size(); ++m)
+        {
+            merged[m] = std::make_unique<BuildNode>();
+            merged[m]->children[0] = take(merges[m].first);
+            merged[m]->children[1] = take(merges[m].second);
+            join_children(*merged[m]);
+        }
+        std::unique_ptr<BuildNode> left = take(clusters[0]);
+        std::unique_ptr<BuildNode> right = take(clusters[1]);
+        node.children[0] = std::move(left);
+        node.children[1] = std::move(right);
+        join_children(node);
+    }
+
+    void flatten(const BuildNode &build_node, size_t index)
+    {
+        Node &node = nodes[index];
+        node.box = build_node.box;
+        if (build_node.count > 0)
+        {
+            node.offset = static_cast<std::uint32_t>(build_node.start);
+            node.count = static_cast<std::uint16_t>(build_node.count);
+            return;
+        }
+
+        size_t right = index + 1 + build_node.children[0]->node_count;
+        node.offset = static_cast<std::uint32_t>(right);
+        node.axis = static_cast<std::uint8_t>(build_node.axis);
+        if (options.parallel && build_node.node_count >= parallel_subtree_threshold)
+        {
+            tbb::parallel_invoke(
+                [&] { flatten(*build_node.children[0], index + 1); },
+                [&] { flatten(*build_node.children[1], right); });
+        }
+        else
+        {
+            flatten(*build_node.children[0], index + 1);
+            flatten(*build_node.children[1], right);
+        }
+    }
+
+    template <typename BoxOf>
+    AABB reduce_bounds(const std::vector<BuildPrimitive> &build_primitives, size_t start, size_t end, const BoxOf &box_of) const
+    {
+        if (!parallel_range(start, end))
+        {
+            AABB box = AABB::empty();
+            for (size_t i = start; i < end; ++i)
+                box = AABB::surrounding_box(box, box_of(build_primitives[i]));
+            return box;
+        }
+
+        return tbb::parallel_reduce(
+            tbb::blocked_range<size_t>(start, end, 4096), AABB::empty(),
+            [&](const tbb::blocked_range<size_t> &range, AABB box)
+            {
+                for (size_t i = range.begin(); i != range.end(); ++i)
+                    box = AABB::surrounding_box(box, box_of(build_primitives[i]));
+                return box;
+            },
+            [](const AABB &a, const AABB &b) { return AABB::surrounding_box(a, b); });
+    }
+
+    // Stable partition so the parallel and serial paths produce the same order.
+    template <typename Predicate>
+    size_t partition_range(std::vector<BuildPrimitive> &build_primitives, std::vector<BuildPrimitive> &scratch, size_t start, size_t end, const Predicate &predicate) const
+    {
+        if (!parallel_range(start, end))
+        {
+            auto middle = std::stable_partition(build_primitives.begin() + start, build_primitives.begin() + end, predicate);
+            return static_cast<size_t>(middle - build_primitives.begin());
+        }
+
+        constexpr size_t block_size = 16 * 1024;
+        size_t block_count = (end - start + block_size - 1) / block_size;
+        std::vector<size_t> left_offsets(block_count + 1, 0);
+        tbb::parallel_for(size_t(0), block_count, [&](size_t b)
+        {
+            size_t block_end = std::min(start + (b + 1) * block_size, end);
+            left_offsets[b + 1] = std::count_if(build_primitives.begin() + start + b * block_size, build_primitives.begin() + block_end, predicate);
+        });
+        for (size_t b = 0; b < block_count; ++b)
+            left_offsets[b + 1] += left_offsets[b];
+        size_t left_total = left_offsets[block_count];
+
+        tbb::parallel_for(size_t(0), block_count, [&](size_t b)
+        {
+            size_t block_start = start + b * block_size;
+            size_t block_end = std::min(block_start + block_size, end);
+            size_t left = start + left_offsets[b];
+            size_t right = start + left_total + (b * block_size - left_offsets[b]);
+            for (size_t i = block_start; i < block_end; ++i)
+            {
+                if (predicate(build_primitives[i]))
+                    scratch[left++] = build_primitives[i];
+                else
+                    scratch[right++] = build_primitives[i];
+            }
+        });
+        tbb::parallel_for(tbb::blocked_range<size_t>(start, end, block_size), [&](const tbb::blocked_range<size_t> &range)
+        {
+            std::copy(scratch.begin() + range.begin(), scratch.begin() + range.end(), build_primitives.begin() + range.begin());
+        });
+        return start + left_total;
+    }
+
+    size_t partition_median(std::vector<BuildPrimitive> &build_primitives, size_t start, size_t end, const AABB &total_box, int &axis) const
+    {
         // Choose the longest axis instead of random
-        int axis = 0;
-        if (object_span > 1) {
-            AABB total_box = AABB::empty();
-            for (size_t i = start; i < end; ++i) {
-                total_box = AABB::surrounding_box(total_box, objects[i]->bounding_box(time1));
+        axis = total_box.longest_axis();
+
+        // Ties are broken by source index so every sort yields the same order.
+        auto comparator = [axis](const BuildPrimitive &a, const BuildPrimitive &b)
+        {
+            FloatType key_a = a.box.axis(axis).min;
+            FloatType key_b = b.box.axis(axis).min;
+            return key_a < key_b || (key_a == key_b && a.index < b.index);
+        };
+
+        if (parallel_range(start, end))
+            tbb::parallel_sort(build_primitives.begin() + start, build_primitives.begin() + end, comparator);
+        else
+            std::sort(build_primitives.begin() + start, build_primitives.begin() + end, comparator);
+        return start + (end - start) / 2;
+    }
+
+    ObjectSplit find_object_split(const std::vector<BuildPrimitive> &build_primitives, size_t start, size_t end) const
+    {
+        const int bin_count = std::max(options.sah_bins, 2);
+
+        AABB centroid_box = reduce_bounds(build_primitives, start, end, [](const BuildPrimitive &p) { return AABB(p.centroid, p.centroid); });
+
+        FloatType scales[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            const Interval &extent = centroid_box.axis(a);
+            scales[a] = extent.max > extent.min ? bin_count / (extent.max - extent.min) : zero_f;
+        }
+
+        // Bins of all three axes, stored axis after axis.
+        auto accumulate = [&](size_t range_start, size_t range_end, std::vector<Bin> &bins)
+        {
+            for (size_t i = range_start; i < range_end; ++i)
+            {
+                const BuildPrimitive &p = build_primitives[i];
+                for (int a = 0; a < 3; ++a)
+                {
+                    if (scales[a] == zero_f)
+                        continue;
+                    Bin &bin = bins[a * bin_count + bin_index(p.centroid[a], centroid_box.axis(a).min, scales[a], bin_count)];
+                    bin.count++;
+                    bin.box = AABB::surrounding_box(bin.box, p.box);
+                }
+            }
+        };
+
+        std::vector<Bin> bins(3 * bin_count);
+        if (parallel_range(start, end))
+        {
+            bins = tbb::parallel_reduce(
+                tbb::blocked_range<size_t>(start, end, 4096), bins,
+                [&](const tbb::blocked_range<size_t> &range, std::vector<Bin> partial)
+                {
+                    accumulate(range.begin(), range.end(), partial);
+                    return partial;
+                },
+                [](std::vector<Bin> a, const std::vector<Bin> &b)
+                {
+                    for (size_t i = 0; i < a.size(); ++i)
+                    {
+                        a[i].count += b[i].count;
+                        a[i].box = AABB::surrounding_box(a[i].box, b[i].box);
+                    }
+                    return a;
+                });
+        }
+        else
+        {
+            accumulate(start, end, bins);
+        }
+
+        std::vector<AABB> right_boxes(bin_count, AABB::empty());
+        std::vector<size_t> right_counts(bin_count);
+
+        ObjectSplit best;
+        for (int a = 0; a < 3; ++a)
+        {
+            if (scales[a] == zero_f)
+                continue;
+            const Bin *axis_bins = bins.data() + a * bin_count;
+
+            // Sweep from the right to accumulate the bounds and count of every
+            // right partition, then from the left to evaluate each split.
+            AABB right_box = AABB::empty();
+            size_t right_count = 0;
+            for (int b = bin_count - 1; b > 0; --b)
+            {
+                right_box = AABB::surrounding_box(right_box, axis_bins[b].box);
+                right_count += axis_bins[b].count;
+                right_boxes[b] = right_box;
+                right_counts[b] = right_count;
             }
+
+            AABB left_box = AABB::empty();
+            size_t left_count = 0;
+            for (int b = 1; b < bin_count; ++b)
+            {
+                left_box = AABB::surrounding_box(left_box, axis_bins[b - 1].box);
+                left_count += axis_bins[b - 1].count;
+                if (left_count == 0 || right_counts[b] == 0)
+                    continue;
+                FloatType cost = left_count * left_box.surface_area() + right_counts[b] * right_boxes[b].surface_area();
+                if (cost < best.cost)
+                    best = {cost, a, b, centroid_box.axis(a).min, scales[a], left_box, right_boxes[b]};
+            }
+        }
+        return best;
+    }
+
+    // Returns the first index of the right partition, or `start` when a leaf
+    // is cheaper than the best split.
+    size_t partition_sah(std::vector<BuildPrimitive> &build_primitives, std::vector<BuildPrimitive> &scratch, size_t start, size_t end, const AABB &total_box, int &axis) const
+    {
+        size_t object_span = end - start;
+        const int bin_count = std::max(options.sah_bins, 2);
+        const size_t max_leaf_size = static_cast<size_t>(std::max(options.max_leaf_size, 1));
+
+        ObjectSplit split = find_object_split(build_primitives, start, end);
+        if (split.axis < 0)
+        {
+            // All centroids coincide, so no bin split separates them.
+            if (object_span <= max_leaf_size)
+                return start;
             axis = total_box.longest_axis();
+            return start + object_span / 2;
         }
-        
-        auto comparator = [axis, time1](const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b)
+
+        if (object_span <= max_leaf_size && leaf_cost(object_span) <= split_cost(split.cost, total_box, object_span))
+            return start;
+
+        axis = split.axis;
+        return partition_range(build_primitives, scratch, start, end, [&](const BuildPrimitive &p)
+        {
+            return bin_index(p.centroid[split.axis], split.min, split.scale, bin_count) < split.bin;
+        });
+    }
+
+    // SAH cost of testing the primitives of a leaf.
+    FloatType leaf_cost(size_t count) const
+    {
+        const size_t width = static_cast<size_t>(std::max(options.leaf_width, 1));
+        return intersection_cost * static_cast<FloatType>((count + width - 1) / width);
+    }
+
+    // Normalized cost of splitting a node whose children sum to `cost`.
+    static FloatType split_cost(FloatType cost, const AABB &box, size_t count)
+    {
+        FloatType area = box.surface_area();
+        return traversal_cost + (area > zero_f ? intersection_cost * cost / area : intersection_cost * count);
+    }
+
+    std::unique_ptr<BuildNode> build_spatial(const std::vector<std::shared_ptr<Hittable>> &objects, std::vector<BuildPrimitive> references,
+                                             FloatType root_area, size_t budget, int depth) const
+    {
+        size_t count = references.size();
+        const size_t max_leaf_size = static_cast<size_t>(std::max(options.max_leaf_size, 1));
+        auto node = std::make_unique<BuildNode>();
+        node->box = reduce_bounds(references, 0, count, [](const BuildPrimitive &p) { return p.box; });
+
+        auto make_leaf = [&]
         {
-            const auto box_a = a->bounding_box(time1);
-            const auto box_b = b->bounding_box(time1);
-            return box_a.axis(axis).min < box_b.axis(axis).min;
+            node->count = count;
+            node->references = std::move(references);
+            return std::move(node);
         };
 
-        if (object_span == 1)
+        std::vector<BuildPrimitive> left;
+        std::vector<BuildPrimitive> right;
+        int axis = 0;
+        size_t used = 0;
+        if (count <= 1)
+            return make_leaf();
+
+        // Past half the depth budget only median splits are made, as in build().
+        bool deep = depth >= max_depth / 2;
+        ObjectSplit object;
+        SpatialSplit spatial;
+        if (!deep)
+        {
+            object = find_object_split(references, 0, count);
+            AABB overlap = AABB::intersection(object.left_box, object.right_box);
+            if (object.axis < 0 || (!overlap.is_empty() && overlap.surface_area() > spatial_split_alpha * root_area))
+                spatial = find_spatial_split(objects, references, node->box);
+            if (spatial.duplicates > budget)
+                spatial = SpatialSplit();
+        }
+
+        FloatType best_cost = std::min(object.cost, spatial.cost);
+        if (deep || best_cost == infinity_f)
+        {
+            if (count <= max_leaf_size)
+                return make_leaf();
+            size_t mid = count / 2;
+            if (deep)
+                mid = partition_median(references, 0, count, node->box, axis);
+            else
+                axis = node->box.longest_axis();
+            left.assign(references.begin(), references.begin() + mid);
+            right.assign(references.begin() + mid, references.end());
+        }
+        else if (count <= max_leaf_size && leaf_cost(count) <= split_cost(best_cost, node->box, count))
+        {
+            return make_leaf();
+        }
+        else if (spatial.cost < object.cost)
         {
-            node.object = objects[start];
-            node.box = node.object->bounding_box(time1);
+            axis = spatial.axis;
+            split_references(objects, references, node->box, spatial, left, right);
+            used = left.size() + right.size() - count;
         }
         else
         {
-            std::sort(objects.begin() + start, objects.begin() + end, comparator);
-            size_t mid = start + object_span / 2;
-            node.left = build(objects, start, mid, time1);
-            node.right = build(objects, mid, end, time1);
-            node.box = AABB::surrounding_box(node.left->box, node.right->box);
+            axis = object.axis;
+            const int bin_count = std::max(options.sah_bins, 2);
+            std::vector<BuildPrimitive> scratch(parallel_range(0, count) ? count : 0);
+            size_t mid = partition_range(references, scratch, 0, count, [&](const BuildPrimitive &p)
+            {
+                return bin_index(p.centroid[object.axis], object.min, object.scale, bin_count) < object.bin;
+            });
+            left.assign(references.begin(), references.begin() + mid);
+            right.assign(references.begin() + mid, references.end());
         }
+        references = {};
+
+        // The remaining budget is shared in proportion to the child sizes so
+        // the parallel and serial builds agree.
+        size_t remaining = budget > used ? budget - used : 0;
+        size_t left_budget = remaining * left.size() / (left.size() + right.size());
+        size_t right_budget = remaining - left_budget;
 
-        return std::make_shared<Node>(node);
+        node->axis = axis;
+        if (options.parallel && count >= parallel_subtree_threshold)
+        {
+            tbb::parallel_invoke(
+                [&] { node->children[0] = build_spatial(objects, std::move(left), root_area, left_budget, depth + 1); },
+                [&] { node->children[1] = build_spatial(objects, std::move(right), root_area, right_budget, depth + 1); });
+        }
+        else
+        {
+            node->children[0] = build_spatial(objects, std::move(left), root_area, left_budget, depth + 1);
+            node->children[1] = build_spatial(objects, std::move(right), root_area, right_budget, depth + 1);
+        }
+        node->node_count = 1 + node->children[0]->node_count + node->children[1]->node_count;
+        return node;
     }
 
-    static bool hit_node(const Node *node, const Ray &r, Interval t_range, HitRecord &rec)
+    // Bins every reference into the spatial bins it overlaps on each axis,
+    // clipping it to each bin, and returns the cheapest bin boundary.
+    SpatialSplit find_spatial_split(const std::vector<std::shared_ptr<Hittable>> &objects, const std::vector<BuildPrimitive> &references, const AABB &box) const
     {
-        if (!node || !node->box.hit(r, t_range))
-            return false;
+        const int bin_count = std::max(options.sah_bins, 2);
+        size_t count = references.size();
+        SpatialSplit best;
+
+        for (int a = 0; a < 3; ++a)
+        {
+            const Interval &extent = box.axis(a);
+            if (extent.max <= extent.min)
+                continue;
+            FloatType scale = bin_count / (extent.max - extent.min);
+            auto plane = [&](int b) { return b == bin_count ? extent.max : extent.min + b / scale; };
+
+            auto accumulate = [&](size_t range_start, size_t range_end, std::vector<SpatialBin> &bins)
+            {
+                for (size_t i = range_start; i < range_end; ++i)
+                {
+                    const BuildPrimitive &reference = references[i];
+                    int first = bin_index(reference.box.axis(a).min, extent.min, scale, bin_count);
+                    int last = bin_index(reference.box.axis(a).max, extent.min, scale, bin_count);
+                    bins[first].entries++;
+                    bins[last].exits++;
+                    if (first == last)
+                    {
+                        bins[first].box = AABB::surrounding_box(bins[first].box, reference.box);
+                        continue;
+                    }
+                    for (int b = first; b <= last; ++b)
+                    {
+                        AABB fragment = clip_reference(objects, reference, slab(box, a, plane(b), plane(b + 1)));
+                        if (!fragment.is_empty())
+                            bins[b].box = AABB::surrounding_box(bins[b].box, fragment);
+                    }
+                }
+            };
+
+            std::vector<SpatialBin> bins(bin_count);
+            if (parallel_range(0, count))
+            {
+                bins = tbb::parallel_reduce(
+                    tbb::blocked_range<size_t>(0, count, 4096), bins,
+                    [&](const tbb::blocked_range<size_t> &range, std::vector<SpatialBin> partial)
+                    {
+                        accumulate(range.begin(), range.end(), partial);
+                        return partial;
+                    },
+                    [](std::vector<SpatialBin> a, const std::vector<SpatialBin> &b)
+                    {
+                        for (size_t i = 0; i < a.size(); ++i)
+                        {
+                            a[i].entries += b[i].entries;
+                            a[i].exits += b[i].exits;
+                            a[i].box = AABB::surrounding_box(a[i].box, b[i].box);
+                        }
+                        return a;
+                    });
+            }
+            else
+            {
+                accumulate(0, count, bins);
+            }
 
-        if (node->object)
-            return node->object->hit(r, t_range, rec);
+            std::vector<AABB> right_boxes(bin_count, AABB::empty());
+            std::vector<size_t> right_counts(bin_count);
+            AABB right_box = AABB::empty();
+            size_t right_count = 0;
+            for (int b = bin_count - 1; b > 0; --b)
+            {
+                right_box = AABB::surrounding_box(right_box, bins[b].box);
+                right_count += bins[b].exits;
+                right_boxes[b] = right_box;
+                right_counts[b] = right_count;
+            }
 
-        bool hit_left = hit_node(node->left.get(), r, t_range, rec);
-        bool hit_right = hit_node(node->right.get(), r, Interval(t_range.min, hit_left ? rec.t : t_range.max), rec);
-        return hit_left || hit_right;
+            AABB left_box = AABB::empty();
+            size_t left_count = 0;
+            for (int b = 1; b < bin_count; ++b)
+            {
+                left_box = AABB::surrounding_box(left_box, bins[b - 1].box);
+                left_count += bins[b - 1].entries;
+                if (left_count == 0 || right_counts[b] == 0 || left_box.is_empty() || right_boxes[b].is_empty())
+                    continue;
+                FloatType cost = left_count * left_box.surface_area() + right_counts[b] * right_boxes[b].surface_area();
+                if (cost < best.cost)
+                    best = {cost, a, plane(b), left_count + right_counts[b] - count};
+            }
+        }
+        return best;
+    }
+
+    // Distributes references to the sides of a spatial split. A straddling
+    // reference is clipped into both sides unless moving it whole to one
+    // side is cheaper.
+    void split_references(const std::vector<std::shared_ptr<Hittable>> &objects, const std::vector<BuildPrimitive> &references, const AABB &box,
+                          const SpatialSplit &split, std::vector<BuildPrimitive> &left, std::vector<BuildPrimitive> &right) const
+    {
+        struct Straddler
+        {
+            const BuildPrimitive *reference;
+            AABB left;
+            AABB right;
+        };
+
+        int a = split.axis;
+        AABB left_half = slab(box, a, box.axis(a).min, split.position);
+        AABB right_half = slab(box, a, split.position, box.axis(a).max);
+        AABB left_box = AABB::empty();
+        AABB right_box = AABB::empty();
+        std::vector<Straddler> straddlers;
+
+        auto add = [](std::vector<BuildPrimitive> &side, AABB &side_box, const AABB &fragment, std::uint32_t index)
+        {
+            side.push_back({fragment, fragment.centroid(), index});
+            side_box = AABB::surrounding_box(side_box, fragment);
+        };
+
+        for (const BuildPrimitive &reference : references)
+        {
+            if (reference.box.axis(a).max <= split.position)
+            {
+                add(left, left_box, reference.box, reference.index);
+                continue;
+            }
+            if (reference.box.axis(a).min >= split.position)
+            {
+                add(right, right_box, reference.box, reference.index);
+                continue;
+            }
+            AABB left_fragment = clip_reference(objects, reference, left_half);
+            AABB right_fragment = clip_reference(objects, reference, right_half);
+            if (left_fragment.is_empty())
+                add(right, right_box, right_fragment.is_empty() ? reference.box : right_fragment, reference.index);
+            else if (right_fragment.is_empty())
+                add(left, left_box, left_fragment, reference.index);
+            else
+                straddlers.push_back({&reference, left_fragment, right_fragment});
+        }
+
+        size_t left_count = left.size() + straddlers.size();
+        size_t right_count = right.size() + straddlers.size();
+        for (const Straddler &straddler : straddlers)
+        {
+            left_box = AABB::surrounding_box(left_box, straddler.left);
+            right_box = AABB::surrounding_box(right_box, straddler.right);
+        }
+
+        for (const Straddler &straddler : straddlers)
+        {
+            const BuildPrimitive &reference = *straddler.reference;
+            AABB unsplit_left = AABB::surrounding_box(left_box, reference.box);
+            AABB unsplit_right = AABB::surrounding_box(right_box, reference.box);
+            FloatType split_cost = left_count * left_box.surface_area() + right_count * right_box.surface_area();
+            FloatType left_cost = left_count * unsplit_left.surface_area() + (right_count - 1) * right_box.surface_area();
+            FloatType right_cost = (left_count - 1) * left_box.surface_area() + right_count * unsplit_right.surface_area();
+            if (left_cost < split_cost && left_cost <= right_cost)
+            {
+                add(left, left_box, reference.box, reference.index);
+                right_count--;
+            }
+            else if (right_cost < split_cost)
+            {
+                add(right, right_box, reference.box, reference.index);
+                left_count--;
+            }
+            else
+            {
+                add(left, left_box, straddler.left, reference.index);
+                add(right, right_box, straddler.right, reference.index);
+            }
+        }
+    }
+
+    // Box of the part of a reference inside `clip`; empty when there is none.
+    static AABB clip_reference(const std::vector<std::shared_ptr<Hittable>> &objects, const BuildPrimitive &reference, const AABB &clip)
+    {
+        AABB bounds = AABB::intersection(reference.box, clip);
+        if (bounds.is_empty())
+            return bounds;
+        AABB clipped = AABB::empty();
+        if (objects.empty() || !objects[reference.index]->clipped_bounding_box(bounds, clipped))
+            return bounds;
+        if (clipped.is_empty())
+            return clipped;
+
+        // Flat fragments keep the padded extent of the reference box.
+        return AABB(
+            clipped.x.max > clipped.x.min ? clipped.x : bounds.x,
+            clipped.y.max > clipped.y.min ? clipped.y : bounds.y,
+            clipped.z.max > clipped.z.min ? clipped.z : bounds.z);
     }
-};
 
+    static AABB slab(const AABB &box, int axis, FloatType min, FloatType max)
+    {
+        return AABB(
+            axis == 0 ? Interval(min, max) : box.x,
+            axis == 1 ? Interval(min, max) : box.y,
+            axis == 2 ? Interval(min, max) : box.z);
+    }
+
+    // Concatenates the leaf references of an SBVH build in depth-first order.
+    static void lay_out_leaves(BuildNode &node, std::vector<BuildPrimitive> &build_primitives)
+    {
+        if (node.count > 0)
+        {
+            node.start = build_primitives.size();
+            build_primitives.insert(build_primitives.end(), node.references.begin(), node.references.end());
+            node.references = {};
+            return;
+        }
+        lay_out_leaves(*node.children[0], build_primitives);
+        lay_out_leaves(*node.children[1], build_primitives);
+    }
+
+    static int bin_index(FloatType value, FloatType min, FloatType scale, int bin_count)
+    {
+        int b = static_cast<int>((value - min) * scale);
+        return std::clamp(b, 0, bin_count - 1);
+    }
+
+    FloatType shutter_fraction(FloatType time) const
+    {
+        return std::clamp((time - time0) / (time1 - time0), zero_f, one_f);
+    }
+
+    static bool is_moving(const MotionBox &m)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            if (m.start.axis(a).min != m.end.axis(a).min || m.start.axis(a).max != m.end.axis(a).max)
+                return true;
+        }
+        return false;
+    }
+
+    // Fills `motion_boxes` bottom-up from the primitive bounds, given in leaf order.
+    void compute_motion_boxes(const std::vector<MotionBox> &primitive_motion, size_t index)
+    {
+        const Node &node = nodes[index];
+        MotionBox &motion = motion_boxes[index];
+        if (node.is_leaf())
+        {
+            motion = {AABB::empty(), AABB::empty()};
+            for (std::uint32_t i = 0; i < node.count; ++i)
+            {
+                motion.start = AABB::surrounding_box(motion.start, primitive_motion[node.offset + i].start);
+                motion.end = AABB::surrounding_box(motion.end, primitive_motion[node.offset + i].end);
+            }
+            return;
+        }
+
+        size_t left_nodes = node.offset - index - 1;
+        if (options.parallel && left_nodes >= parallel_subtree_threshold)
+        {
+            tbb::parallel_invoke(
+                [&] { compute_motion_boxes(primitive_motion, index + 1); },
+                [&] { compute_motion_boxes(primitive_motion, node.offset); });
+        }
+        else
+        {
+            compute_motion_boxes(primitive_motion, index + 1);
+            compute_motion_boxes(primitive_motion, node.offset);
+        }
+        motion.start = AABB::surrounding_box(motion_boxes[index + 1].start, motion_boxes[node.offset].start);
+        motion.end = AABB::surrounding_box(motion_boxes[index + 1].end, motion_boxes[node.offset].end);
+    }
+
+    // With `AnyHit`, stops at the first leaf that reports a hit and leaves
+    // `rec` alone.
+    template <bool Motion, bool AnyHit, typename HitLeaf>
+    bool traverse_nodes(const Ray &r, Interval t_range, HitRecord &rec, const HitLeaf &hit_leaf) const
+    {
+        SlabRay ray(r);
+        FloatType s = Motion ? shutter_fraction(r.time) : zero_f;
+        std::uint32_t stack[max_depth];
+        int top = 0;
+        std::uint32_t index = 0;
+        bool hit_anything = false;
+        RayCounters counters;
+
+        while (true)
+        {
+            const Node &node = nodes[index];
+            if constexpr (RayStats::enabled)
+                ++counters.nodes_visited;
+            bool hit_box;
+            if constexpr (Motion)
+                hit_box = motion_boxes[index].hit(ray, s, t_range);
+            else
+                hit_box = node.box.hit(ray, t_range);
+            if (hit_box)
+            {
+                if (node.is_leaf())
+                {
+                    int hits = hit_leaf(node.offset, node.count, t_range, rec);
+                    if constexpr (RayStats::enabled)
+                        counters.primitive_hits += hits;
+                    if constexpr (RayStats::enabled)
+                        counters.primitive_tests += node.count;
+                    if (hits > 0)
+                    {
+                        hit_anything = true;
+                        if constexpr (AnyHit)
+                            break;
+                        t_range.max = rec.t;
+                    }
+                }
+                else
+                {
+                    // Visit the child on the near side of the split first so
+                    // a hit there shrinks t_range before the far side is tested.
+                    if (ray.direction_is_negative[node.axis])
+                    {
+                        stack[top++] = index + 1;
+                        index = node.offset;
+                    }
+                    else
+                    {
+                        stack[top++] = node.offset;
+                        index = index + 1;
+                    }
+                    continue;
+                }
+            }
+            if (top == 0)
+                break;
+            index = stack[--top];
+        }
+
+        if constexpr (RayStats::enabled)
+        {
+            counters.traversals = 1;
+            RayStats::record(counters);
+        }
+        return hit_anything;
+    }
+
+    // Packet version of `traverse_nodes`: every node is tested once for all
+    // lanes still active in its subtree, and children are ordered by the
+    // direction of the first active lane, which coherent lanes share. As in
+    // `hit`, each lane completes the record of its nearest hit only once the
+    // traversal is done.
+    template <bool Motion>
+    std::uint32_t traverse_packet(const Ray *rays, RayPacket &packet, HitRecord *hit_records) const
+    {
+        struct Entry
+        {
+            std::uint32_t index;
+            std::uint32_t mask;
+        };
+        Entry stack[max_depth];
+        int top = 0;
+        Entry entry{0, packet.all_lanes()};
+        std::uint32_t hits = 0;
+        PrimitiveHit nearest_hits[RayPacket::max_size]; // per lane, completed after the traversal
+        RayCounters counters;
+
+        while (true)
+        {
+            const Node &node = nodes[entry.index];
+            std::uint32_t mask;
+            if constexpr (Motion)
+            {
+                const MotionBox &box = motion_boxes[entry.index];
+                FloatType lo0[3] = {box.start.x.min, box.start.y.min, box.start.z.min};
+                FloatType hi0[3] = {box.start.x.max, box.start.y.max, box.start.z.max};
+                FloatType lo1[3] = {box.end.x.min, box.end.y.min, box.end.z.min};
+                FloatType hi1[3] = {box.end.x.max, box.end.y.max, box.end.z.max};
+                mask = packet.intersect(lo0, hi0, lo1, hi1, entry.mask);
+            }
+            else
+            {
+                FloatType lo[3] = {node.box.x.min, node.box.y.min, node.box.z.min};
+                FloatType hi[3] = {node.box.x.max, node.box.y.max, node.box.z.max};
+                mask = packet.intersect(lo, hi, entry.mask);
+            }
+            if constexpr (RayStats::enabled)
+                ++counters.nodes_visited;
+
+            if (mask != 0)
+            {
+                if (node.is_leaf())
+                {
+                    for (std::uint32_t i = 0; i < node.count; ++i)
+                    {
+                        for (std::uint32_t lanes = mask; lanes != 0; lanes &= lanes - 1)
+                        {
+                            int l = std::countr_zero(lanes);
+                            if (table->intersect(node.offset + i, rays[l], Interval(packet.t_min, packet.t_max[l]), nearest_hits[l], hit_records[l]))
+                            {
+                                hits |= 1u << l;
+                                packet.t_max[l] = hit_records[l].t;
+                                if constexpr (RayStats::enabled)
+                                    ++counters.primitive_hits;
+                            }
+                            if constexpr (RayStats::enabled)
+                                ++counters.primitive_tests;
+                        }
+                    }
+                }
+                else
+                {
+                    int first = std::countr_zero(mask);
+                    if (packet.inv_direction[node.axis][first] < zero_f)
+                    {
+                        stack[top++] = {entry.index + 1, mask};
+                        entry = {node.offset, mask};
+                    }
+                    else
+                    {
+                        stack[top++] = {node.offset, mask};
+                        entry = {entry.index + 1, mask};
+                    }
+                    continue;
+                }
+            }
+            if (top == 0)
+                break;
+            entry = stack[--top];
+        }
+
+        for (std::uint32_t lanes = hits; lanes != 0; lanes &= lanes - 1)
+        {
+            int l = std::countr_zero(lanes);
+            table->compute_surface_interaction(rays[l], nearest_hits[l], hit_records[l]);
+        }
+
+        if constexpr (RayStats::enabled)
+        {
+            counters.traversals = packet.size;
+            RayStats::record(counters);
+        }
+        return hits;
+    }
+};
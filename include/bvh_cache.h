@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+
+// Versioned binary cache of a built BVH, so runs over an unchanged scene can
+// skip the build. A cache file is keyed by `scene_hash`, which covers the
+// geometry of every object, the shutter interval and the build options.
+namespace BVHCache
+{
+    std::uint64_t scene_hash(const std::vector<std::shared_ptr<Hittable>> &objects, FloatType time0, FloatType time1,
+                             const BVHBuildOptions &options);
+
+    // Writes the node, motion box and index arrays of `bvh`. Returns false
+    // when the file could not be written.
+    bool save(const std::string &path, const BVH &bvh, std::uint64_t hash);
+
+    // Maps the cache file and rebuilds the BVH from it, binding its leaves to
+    // `objects` by source index. Returns null when the file is missing,
+    // malformed, written by another version or for a different scene.
+    std::unique_ptr<BVH> load(const std::string &path, std::uint64_t hash,
+                              const std::vector<std::shared_ptr<Hittable>> &objects, const BVHBuildOptions &options);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "bvh.h"
+
+// Quality report of a built BVH, gathered in one pass over its nodes.
+struct BVHStats
+{
+    size_t node_count = 0;
+    size_t leaf_count = 0;
+    size_t reference_count = 0;
+    std::vector<size_t> leaves_per_depth; // depth histogram of the leaves, the root is at depth 0
+    FloatType sah_cost = zero_f;
+    FloatType average_leaf_size = zero_f;
+    size_t memory_bytes = 0; // nodes, motion boxes, indices and primitive pointers
+    // Mean over interior nodes of the surface area shared by the two child
+    // boxes, relative to the node's own area. Rays entering the shared
+    // region have to descend into both children.
+    FloatType overlap_ratio = zero_f;
+
+    static BVHStats collect(const BVH &bvh);
+
+    void log() const;
+};
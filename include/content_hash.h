@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "aabb.h"
+#include "common.h"
+
+// 64-bit FNV-1a hash over raw bytes, used to fingerprint scene content.
+struct ContentHash
+{
+    std::uint64_t value = 14695981039346656037ull;
+
+    void add(const void *data, std::size_t size)
+    {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            value ^= bytes[i];
+            value *= 1099511628211ull;
+        }
+    }
+
+    void add(std::uint64_t v) { add(&v, sizeof(v)); }
+    void add(FloatType v) { add(&v, sizeof(v)); }
+
+    void add(const Vec3 &v)
+    {
+        add(v.x);
+        add(v.y);
+        add(v.z);
+    }
+
+    void add(const AABB &box)
+    {
+        add(box.x.min);
+        add(box.x.max);
+        add(box.y.min);
+        add(box.y.max);
+        add(box.z.min);
+        add(box.z.max);
+    }
+};
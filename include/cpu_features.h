@@ -0,0 +1,22 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RT_X86_64 1
+#endif
+
+// Marks a function as compiled for an instruction set the build does not
+// enable globally. Callers must check the matching cpu_supports_* first.
+#if defined(RT_X86_64) && (defined(__GNUC__) || defined(__clang__))
+#define RT_TARGET_AVX __attribute__((target("avx")))
+#define RT_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define RT_TARGET_AVX
+#define RT_TARGET_AVX512
+#endif
+
+namespace CpuFeatures
+{
+    bool supports_avx();
+
+    bool supports_avx512f();
+}
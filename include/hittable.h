@@ -1,9 +1,12 @@
 #pragma once
 
+#include <cstdint>
+
 #include "ray.h"
 #include "interval.h"
 #include "common.h"
 #include "aabb.h"
+#include "content_hash.h"
 
 class Material;
 
@@ -36,10 +39,65 @@ private:
     HitRecord() : point(Point3::uninitialized()), normal(Vec3::uninitialized()) {}
 };
 
+// Where a ray meets a primitive, before any shading data is derived from
+// it: enough to rebuild the surface interaction once the nearest hit is
+// known. Primitives fill `t` and the coordinates they need; acceleration
+// structures set `primitive` and complete a `HitRecord` only for the
+// nearest hit.
+struct PrimitiveHit
+{
+    FloatType t;
+    FloatType b1;            // surface coordinates: barycentrics or quad coordinates
+    FloatType b2;
+    std::uint32_t primitive; // which primitive of the structure was hit
+    std::uint32_t face;      // which face of a box was hit
+};
+
 struct Hittable
 {
     virtual ~Hittable() = default;
     virtual bool hit(const Ray &r, Interval t_range, HitRecord &hit_record) const = 0;
     virtual AABB bounding_box() const = 0;
     virtual AABB bounding_box(FloatType time1) const = 0;
+
+    // Whether anything blocks `r` within `t_range`. Stops at the first hit
+    // found and fills no hit record, for shadow and visibility rays.
+    // Objects that cannot do better than their closest hit keep this
+    // default.
+    virtual bool occluded(const Ray &r, Interval t_range) const
+    {
+        auto hit_record = HitRecord::uninitialized();
+        return hit(r, t_range, hit_record);
+    }
+
+    // Traces `count` rays, at most RayPacket::max_size, and returns a mask of
+    // the lanes that hit. Acceleration structures override it to traverse
+    // coherent rays together; everything else traces them one at a time.
+    virtual std::uint32_t hit_packet(const Ray *rays, int count, Interval t_range, HitRecord *hit_records) const
+    {
+        std::uint32_t hits = 0;
+        for (int l = 0; l < count; ++l)
+        {
+            if (hit(rays[l], t_range, hit_records[l]))
+                hits |= 1u << l;
+        }
+        return hits;
+    }
+
+    // Bounds of the object at one instant. Static objects return their
+    // regular bounding box.
+    virtual AABB bounding_box_at(FloatType /*time*/) const { return bounding_box(); }
+
+    // Bounds of the part of the object inside `clip`, used by spatial-split
+    // BVH builds. Objects that cannot be clipped return false and the builder
+    // intersects their bounding box with `clip` instead.
+    virtual bool clipped_bounding_box(const AABB & /*clip*/, AABB & /*box*/) const { return false; }
+
+    // Adds everything a BVH build over the shutter interval depends on to
+    // `hash`. For objects that cannot be clipped that is their bounds.
+    virtual void hash_geometry(ContentHash &hash, FloatType time0, FloatType time1) const
+    {
+        hash.add(bounding_box_at(time0));
+        hash.add(bounding_box_at(time1));
+    }
 };
\ No newline at end of file
@@ -34,6 +34,16 @@ struct HittableList : public Hittable
         return hit_anything;
     }
 
+    bool occluded(const Ray &r, Interval t_range) const override
+    {
+        for (const auto &object : objects)
+        {
+            if (object->occluded(r, t_range))
+                return true;
+        }
+        return false;
+    }
+
     AABB bounding_box() const override
     {
         if (objects.empty())
@@ -53,4 +63,14 @@ struct HittableList : public Hittable
             box = AABB::surrounding_box(box, objects[i]->bounding_box(t1));
         return box;
     }
+
+    AABB bounding_box_at(FloatType time) const override
+    {
+        if (objects.empty())
+            return AABB::empty();
+        AABB box = objects[0]->bounding_box_at(time);
+        for (size_t i = 1; i < objects.size(); ++i)
+            box = AABB::surrounding_box(box, objects[i]->bounding_box_at(time));
+        return box;
+    }
 };
\ No newline at end of file
@@ -11,13 +11,12 @@
 struct Transform
 {
     Mat4 matrix;
-    Mat4 inverse;
-    Mat4 inverse_transpose;
+    Mat4 inverse; // its transpose maps normals
     Motion motion;
     FloatType time0;
 
     Transform(const Mat4 &m = Mat4::identity(), const Motion &motion = Motion(), FloatType time0 = zero_f)
-        : matrix(m), inverse(m.inverse()), inverse_transpose(inverse.transpose()), motion(motion), time0(time0) {}
+        : matrix(m), inverse(m.inverse()), motion(motion), time0(time0) {}
 };
 
 inline AABB transform_aabb(const AABB &box, const Mat4 &m)
@@ -44,26 +43,58 @@ inline AABB transform_aabb(const AABB &box, const Mat4 &m)
     return AABB(min, max);
 }
 
-struct Instance : public Hittable
+// Places a shared object, optionally with a material of its own. Many
+// instances may share one object and one transform. Primitives only report
+// UVs when their own material reads them, so an object whose material is
+// replaced should have a null material.
+struct Instance final : public Hittable
 {
     std::shared_ptr<Hittable> object;
     std::shared_ptr<Transform> transform;
+    const Material *material; // replaces the materials of `object` when set
 
-    Instance(const std::shared_ptr<Hittable> &object, const std::shared_ptr<Transform> &transform)
-        : object(object), transform(transform) {}
+    Instance(const std::shared_ptr<Hittable> &object, const std::shared_ptr<Transform> &transform, const Material *material = nullptr)
+        : object(object), transform(transform), material(material) {}
 
     bool hit(const Ray &r, Interval t_range, HitRecord &rec) const override
+    {
+        if (!intersect(r, t_range, rec))
+            return false;
+        compute_surface_interaction(r, rec);
+        return true;
+    }
+
+    // The hit of the object in object space; `compute_surface_interaction`
+    // brings the nearest one to world space.
+    bool intersect(const Ray &r, Interval t_range, HitRecord &rec) const
+    {
+        return object->hit(local_ray(r), t_range, rec);
+    }
+
+    void compute_surface_interaction(const Ray &r, HitRecord &rec) const
+    {
+        // The local ray keeps the parameterization of `r`. The object already
+        // turned the normal against the local ray and set `front_face`; the
+        // inverse transpose preserves which side the normal is on.
+        rec.point = r.at(rec.t);
+        rec.normal = Vec3::normalize(transform->inverse.transform_vector_transposed(rec.normal));
+        if (material)
+            rec.material = material;
+    }
+
+    bool occluded(const Ray &r, Interval t_range) const override
+    {
+        return object->occluded(local_ray(r), t_range);
+    }
+
+    // `r` in object space. The direction is not normalized, so distances
+    // along the local ray are distances along `r`.
+    Ray local_ray(const Ray &r) const
     {
         Vec3 offset = (r.time - transform->time0) * transform->motion.linear;
         Point3 origin = transform->inverse.transform_point(r.origin - offset);
         Vec3 direction = transform->inverse.transform_vector(r.direction);
-        Ray local_ray(origin, direction, r.time);
-        if (!object->hit(local_ray, t_range, rec))
-            return false;
-        rec.point = transform->matrix.transform_point(rec.point) + offset;
-        Vec3 n = transform->inverse_transpose.transform_vector(rec.normal);
-        rec.set_face_normal(r, Vec3::normalize(n));
-        return true;
+        return Ray(origin, direction, r.time);
     }
 
     AABB bounding_box() const override
@@ -82,5 +113,13 @@ struct Instance : public Hittable
         AABB box1 = transform_aabb(object->bounding_box(), m1);
         return AABB::surrounding_box(box0, box1);
     }
+
+    AABB bounding_box_at(FloatType time) const override
+    {
+        Mat4 m = transform->matrix;
+        Vec3 trans = (time - transform->time0) * transform->motion.linear;
+        m.set_translation(m.get_translation() + trans);
+        return transform_aabb(object->bounding_box_at(time), m);
+    }
 };
 
@@ -1,15 +1,37 @@
 #pragma once
 
+#include <cstdint>
+
 #include "hittable.h"
 #include "ray.h"
 #include "color.h"
 #include "rand_utils.h"
 #include "texture.h"
 
+// Concrete material type, so renderers can group hits by material and
+// shade each group without virtual dispatch.
+enum class MaterialKind
+{
+    Lambertian,
+    Metal,
+    Dielectric,
+    DiffuseLight,
+    Isotropic,
+    Other, // materials defined outside this header
+};
+
 struct Material
 {
+    static constexpr std::uint32_t no_table_index = ~0u;
+
+    // Position of the material in the `MaterialTable` of its scene, set when
+    // the table is built.
+    std::uint32_t table_index = no_table_index;
+
     virtual ~Material() = default;
 
+    virtual MaterialKind kind() const { return MaterialKind::Other; }
+
     virtual bool scatter(
         const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const = 0;
 
@@ -17,21 +39,36 @@ struct Material
     {
         return Color::black();
     }
+
+    // Whether shading reads the `u` and `v` of a hit. Materials defined
+    // elsewhere are assumed to.
+    virtual bool needs_uv() const { return true; }
 };
 
 struct Lambertian : public Material
 {
     Lambertian(const Texture *albedo) : albedo(albedo) {}
 
+    MaterialKind kind() const override { return MaterialKind::Lambertian; }
+
     bool scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const override
+    {
+        scattered = scatter_ray(r_in, rec);
+        attenuation = albedo->value(rec.u, rec.v, rec.point);
+        return true;
+    }
+
+    // The scattering of every Lambertian surface, whatever its albedo.
+    static Ray scatter_ray(const Ray &r_in, const HitRecord &rec)
     {
         auto scatter_direction = rec.normal + random_unit_sphere();
         if (scatter_direction.near_zero())
             scatter_direction = rec.normal;
-        scattered = Ray(rec.point, scatter_direction, r_in.time);
-        attenuation = albedo->value(rec.u, rec.v, rec.point);
-        return true;
+        return Ray(rec.point, scatter_direction, r_in.time);
     }
+
+    bool needs_uv() const override { return albedo->needs_uv(); }
+
     const Texture *albedo;
 };
 
@@ -40,14 +77,24 @@ struct Metal : public Material
     Metal(const Color &albedo, FloatType fuzz)
         : albedo(albedo), fuzz(fuzz < 0 ? 0 : (fuzz < 1 ? fuzz : 1)) {}
 
+    MaterialKind kind() const override { return MaterialKind::Metal; }
+
     bool scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const override
+    {
+        attenuation = albedo;
+        return scatter_ray(r_in, rec, fuzz, scattered);
+    }
+
+    // False when the fuzzed reflection points below the surface.
+    static bool scatter_ray(const Ray &r_in, const HitRecord &rec, FloatType fuzz, Ray &scattered)
     {
         Vec3 reflected = Vec3::reflect(Vec3::normalize(r_in.direction), rec.normal);
         scattered = Ray(rec.point, reflected + fuzz * random_unit_sphere(), r_in.time);
-        attenuation = albedo;
         return (Vec3::dot(scattered.direction, rec.normal) > 0);
     }
 
+    bool needs_uv() const override { return false; }
+
     Color albedo;
     FloatType fuzz;
 };
@@ -56,9 +103,17 @@ struct Dielectric : public Material
 {
     Dielectric(FloatType refraction_index) : refraction_index(refraction_index) {}
 
+    MaterialKind kind() const override { return MaterialKind::Dielectric; }
+
     bool scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const override
     {
         attenuation = Color(1.0, 1.0, 1.0);
+        scattered = scatter_ray(r_in, rec, refraction_index);
+        return true;
+    }
+
+    static Ray scatter_ray(const Ray &r_in, const HitRecord &rec, FloatType refraction_index)
+    {
         FloatType ri = rec.front_face ? (1.0 / refraction_index) : refraction_index;
 
         Vec3 unit_direction = Vec3::normalize(r_in.direction);
@@ -69,17 +124,17 @@ struct Dielectric : public Material
         if (cannot_refract || reflectance(cos_theta, ri) > random_float())
         {
             Vec3 reflected = Vec3::reflect(unit_direction, rec.normal);
-            scattered = Ray(rec.point, reflected, r_in.time);
-            return true;
+            return Ray(rec.point, reflected, r_in.time);
         }
         else
         {
             Vec3 refracted = Vec3::refract(unit_direction, rec.normal, ri);
-            scattered = Ray(rec.point, refracted, r_in.time);
-            return true;
+            return Ray(rec.point, refracted, r_in.time);
         }
     }
 
+    bool needs_uv() const override { return false; }
+
     FloatType refraction_index;
 
     static FloatType reflectance(FloatType cosine, FloatType refraction_index)
@@ -95,6 +150,8 @@ struct DiffuseLight : public Material
 {
     DiffuseLight(const Texture *emit) : emit(emit) {}
 
+    MaterialKind kind() const override { return MaterialKind::DiffuseLight; }
+
     bool scatter(const Ray &, const HitRecord &, Color &, Ray &) const override
     {
         return false;
@@ -105,6 +162,8 @@ struct DiffuseLight : public Material
         return emit->value(u, v, p);
     }
 
+    bool needs_uv() const override { return emit->needs_uv(); }
+
     const Texture *emit;
 };
 
@@ -112,13 +171,22 @@ struct Isotropic : public Material
 {
     Isotropic(const Texture *albedo) : albedo(albedo) {}
 
+    MaterialKind kind() const override { return MaterialKind::Isotropic; }
+
     bool scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const override
     {
-        scattered = Ray(rec.point, random_unit_sphere(), r_in.time);
+        scattered = scatter_ray(r_in, rec);
         attenuation = albedo->value(rec.u, rec.v, rec.point);
         return true;
     }
 
+    static Ray scatter_ray(const Ray &r_in, const HitRecord &rec)
+    {
+        return Ray(rec.point, random_unit_sphere(), r_in.time);
+    }
+
+    bool needs_uv() const override { return albedo->needs_uv(); }
+
     const Texture *albedo;
 };
 
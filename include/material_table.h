@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "material.h"
+#include "texture.h"
+
+// The materials of a scene as one flat array of tagged entries. An entry
+// keeps the type of its material and that type's parameters inline, so
+// shading is a switch over the tag instead of a virtual call, and a
+// constant albedo or emission is read from the entry instead of through a
+// texture. The `Material` objects stay the source of the scene; a hit finds
+// its entry through `Material::table_index`, and materials that are not in
+// the table, or are defined outside material.h, are shaded through their
+// virtual functions.
+struct MaterialTable
+{
+    struct Entry
+    {
+        MaterialKind kind;
+        FloatType parameter;      // fuzz of a metal, refraction index of a dielectric
+        Color color;              // albedo or emission, when `texture` is null
+        const Texture *texture;   // albedo or emission that varies over the surface
+        const Material *material; // the source material
+    };
+
+    std::vector<Entry> entries;
+
+    MaterialTable() = default;
+
+    explicit MaterialTable(const std::vector<std::unique_ptr<Material>> &materials)
+    {
+        entries.reserve(materials.size());
+        for (const auto &material : materials)
+        {
+            material->table_index = static_cast<std::uint32_t>(entries.size());
+            entries.push_back(entry_of(*material));
+        }
+    }
+
+    // Kind of the entry a hit is shaded with; `Other` when its material is
+    // not in the table.
+    MaterialKind kind_of(const Material &material) const
+    {
+        return in_table(material) ? entries[material.table_index].kind : MaterialKind::Other;
+    }
+
+    Color emitted(const HitRecord &rec) const
+    {
+        if (!in_table(*rec.material))
+            return rec.material->emitted(rec.u, rec.v, rec.point);
+        const Entry &entry = entries[rec.material->table_index];
+        switch (entry.kind)
+        {
+        case MaterialKind::DiffuseLight:
+            return emitted_as<MaterialKind::DiffuseLight>(entry, rec);
+        case MaterialKind::Other:
+            return emitted_as<MaterialKind::Other>(entry, rec);
+        default:
+            return Color::black();
+        }
+    }
+
+    bool scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const
+    {
+        if (!in_table(*rec.material))
+            return rec.material->scatter(r_in, rec, attenuation, scattered);
+        const Entry &entry = entries[rec.material->table_index];
+        switch (entry.kind)
+        {
+        case MaterialKind::Lambertian:
+            return scatter_as<MaterialKind::Lambertian>(entry, r_in, rec, attenuation, scattered);
+        case MaterialKind::Metal:
+            return scatter_as<MaterialKind::Metal>(entry, r_in, rec, attenuation, scattered);
+        case MaterialKind::Dielectric:
+            return scatter_as<MaterialKind::Dielectric>(entry, r_in, rec, attenuation, scattered);
+        case MaterialKind::DiffuseLight:
+            return scatter_as<MaterialKind::DiffuseLight>(entry, r_in, rec, attenuation, scattered);
+        case MaterialKind::Isotropic:
+            return scatter_as<MaterialKind::Isotropic>(entry, r_in, rec, attenuation, scattered);
+        default:
+            return scatter_as<MaterialKind::Other>(entry, r_in, rec, attenuation, scattered);
+        }
+    }
+
+    // Shading of an entry whose kind is known at compile time, for loops
+    // over hits of a single kind. Same results, and same random numbers
+    // drawn, as the member functions of the source material.
+    template <MaterialKind Kind>
+    static Color emitted_as(const Entry &entry, const HitRecord &rec)
+    {
+        if constexpr (Kind == MaterialKind::DiffuseLight)
+            return color_of(entry, rec);
+        else if constexpr (Kind == MaterialKind::Other)
+            return entry.material->emitted(rec.u, rec.v, rec.point);
+        else
+            return Color::black();
+    }
+
+    template <MaterialKind Kind>
+    static bool scatter_as(const Entry &entry, const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered)
+    {
+        if constexpr (Kind == MaterialKind::Lambertian)
+        {
+            scattered = Lambertian::scatter_ray(r_in, rec);
+            attenuation = color_of(entry, rec);
+            return true;
+        }
+        else if constexpr (Kind == MaterialKind::Metal)
+        {
+            attenuation = entry.color;
+            return Metal::scatter_ray(r_in, rec, entry.parameter, scattered);
+        }
+        else if constexpr (Kind == MaterialKind::Dielectric)
+        {
+            attenuation = Color(1.0, 1.0, 1.0);
+            scattered = Dielectric::scatter_ray(r_in, rec, entry.parameter);
+            return true;
+        }
+        else if constexpr (Kind == MaterialKind::DiffuseLight)
+        {
+            return false;
+        }
+        else if constexpr (Kind == MaterialKind::Isotropic)
+        {
+            scattered = Isotropic::scatter_ray(r_in, rec);
+            attenuation = color_of(entry, rec);
+            return true;
+        }
+        else
+        {
+            return entry.material->scatter(r_in, rec, attenuation, scattered);
+        }
+    }
+
+private:
+    bool in_table(const Material &material) const
+    {
+        return material.table_index < entries.size() && entries[material.table_index].material == &material;
+    }
+
+    static Color color_of(const Entry &entry, const HitRecord &rec)
+    {
+        return entry.texture ? entry.texture->value(rec.u, rec.v, rec.point) : entry.color;
+    }
+
+    // A texture that is a single color is folded into the entry.
+    static void store_texture(Entry &entry, const Texture *texture)
+    {
+        if (auto solid = dynamic_cast<const SolidColorTexture *>(texture))
+            entry.color = solid->color_value;
+        else
+            entry.texture = texture;
+    }
+
+    static Entry entry_of(const Material &material)
+    {
+        Entry entry{material.kind(), zero_f, Color::black(), nullptr, &material};
+        switch (entry.kind)
+        {
+        case MaterialKind::Lambertian:
+            store_texture(entry, static_cast<const Lambertian &>(material).albedo);
+            break;
+        case MaterialKind::Metal:
+            entry.color = static_cast<const Metal &>(material).albedo;
+            entry.parameter = static_cast<const Metal &>(material).fuzz;
+            break;
+        case MaterialKind::Dielectric:
+            entry.parameter = static_cast<const Dielectric &>(material).refraction_index;
+            break;
+        case MaterialKind::DiffuseLight:
+            store_texture(entry, static_cast<const DiffuseLight &>(material).emit);
+            break;
+        case MaterialKind::Isotropic:
+            store_texture(entry, static_cast<const Isotropic &>(material).albedo);
+            break;
+        default:
+            break;
+        }
+        return entry;
+    }
+};
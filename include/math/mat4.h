@@ -89,6 +89,16 @@ struct Mat4
             m[2][0]*v.x + m[2][1]*v.y + m[2][2]*v.z);
     }
 
+    // Transform a direction by the transpose of the upper 3x3. Called on the
+    // inverse of a transform, this maps normals.
+    Vec3 transform_vector_transposed(const Vec3 &v) const
+    {
+        return Vec3(
+            m[0][0]*v.x + m[1][0]*v.y + m[2][0]*v.z,
+            m[0][1]*v.x + m[1][1]*v.y + m[2][1]*v.z,
+            m[0][2]*v.x + m[1][2]*v.y + m[2][2]*v.z);
+    }
+
     Mat4 transpose() const
     {
         Mat4 r = *this;
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "primitives/triangle_mesh.h"
+
+// Native binary format of a `TriangleMesh` (.rtmesh): a header followed by
+// the position, index, normal, UV, BVH node and BVH index arrays, each
+// aligned to 64 bytes and in the in-memory layout of this build, so a mapped
+// file can back a mesh without parsing or copying its geometry.
+namespace MeshFile
+{
+    // Writes the arrays and the BVH of `mesh`. Returns false when the file
+    // could not be written.
+    bool save(const std::string &path, const TriangleMesh &mesh);
+
+    // Maps the file and returns a mesh whose arrays point into the mapping.
+    // Only the BVH nodes and BVH indices are copied, and the BVH is checked
+    // with `BVH::is_well_formed` before use. Returns null and logs the reason
+    // when the file is missing, malformed or written by an incompatible build.
+    std::shared_ptr<TriangleMesh> load(const std::string &path, const Material *material);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "primitives/triangle_mesh.h"
+
+// Geometry read from a mesh file, laid out as `TriangleMesh` takes it.
+struct MeshData
+{
+    std::vector<Point3> positions;
+    std::vector<Vec3> normals;          // per vertex, or empty
+    std::vector<TriangleMesh::UV> uvs;  // per vertex, or empty
+    std::vector<std::uint32_t> indices; // three per triangle; polygons are split into fans
+    std::size_t file_size = 0;          // bytes read, for throughput reports
+};
+
+namespace MeshLoader
+{
+    // Reads a Wavefront OBJ or binary PLY file, picked by its extension.
+    // The file is memory-mapped and parsed in parallel chunks straight into
+    // the output arrays. Returns null and logs the reason when the file
+    // cannot be read or is malformed.
+    //
+    // Only geometry is read. OBJ texture coordinates and normals are kept
+    // when every face corner indexes them like its position, since a
+    // `TriangleMesh` has a single index per vertex; otherwise they are
+    // dropped with a warning.
+    std::unique_ptr<MeshData> load(const std::string &path);
+}
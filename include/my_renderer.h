@@ -6,15 +6,19 @@
 class MyRenderer : public Renderer
 {
 public:
-    MyRenderer(int samples_per_pixel, int max_depth, FloatType gamma)
-        : samples_per_pixel(samples_per_pixel), max_depth(max_depth), gamma(gamma) {}
+    // A nonzero `packet_size` (4, 8 or 16) traces the primary rays of pixel
+    // tiles of that size together; bounces are always traced one by one.
+    MyRenderer(int samples_per_pixel, int max_depth, FloatType gamma, int packet_size = 0)
+        : samples_per_pixel(samples_per_pixel), max_depth(max_depth), gamma(gamma), packet_size(packet_size) {}
     void render(
         const Camera &camera,
-        const HittableList &world,
+        const Hittable &world,
+        const MaterialTable &materials,
         const Color &background,
         std::uint8_t *buffer) const override;
 private:
     int samples_per_pixel;
     int max_depth;
     FloatType gamma;
+    int packet_size;
 };
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "hittable.h"
+#include "instance.h"
+#include "primitives/sphere.h"
+#include "primitives/quad.h"
+#include "primitives/triangle.h"
+#include "primitives/box.h"
+#include "primitives/constant_medium.h"
+
+enum class PrimitiveType : std::uint8_t
+{
+    Sphere,
+    Quad,
+    Triangle,
+    Box,
+    Instance,
+    Medium,
+    Other, // meshes, sphere sets, nested trees: anything tested through `Hittable`
+};
+
+// The leaf references of an acceleration structure, flattened into one
+// contiguous array per primitive type. A reference packs the type into its
+// top bits and the position in that type's array below, so a leaf test is a
+// switch over the type and a direct, devirtualized call on a primitive
+// stored by value. Primitives are copied in leaf order, so the references
+// of one leaf that share a type refer to a contiguous range of its array.
+//
+// The `Hittable` objects stay the source of the scene: bounds, refits and
+// caches still go through them.
+struct PrimitiveTable
+{
+    static constexpr int type_shift = 29;
+    static constexpr std::uint32_t index_mask = (1u << type_shift) - 1;
+    static constexpr std::uint32_t complete = ~0u; // `PrimitiveHit::primitive` of a hit already in its record
+
+    std::vector<Sphere> spheres;
+    std::vector<Quad> quads;
+    std::vector<Triangle> triangles;
+    std::vector<Box> boxes;
+    std::vector<Instance> instances;
+    std::vector<ConstantMedium> media;
+    std::vector<std::shared_ptr<const Hittable>> others;
+    std::vector<std::uint32_t> references; // one per leaf reference, in leaf order
+
+    PrimitiveTable() = default;
+
+    // Spatial splits may reference a primitive from several leaves; it is
+    // stored once.
+    explicit PrimitiveTable(const std::vector<std::shared_ptr<Hittable>> &primitives)
+    {
+        std::unordered_map<const Hittable *, std::uint32_t> stored;
+        references.reserve(primitives.size());
+        for (const auto &primitive : primitives)
+        {
+            auto [slot, inserted] = stored.try_emplace(primitive.get(), 0);
+            if (inserted)
+                slot->second = store(primitive);
+            references.push_back(slot->second);
+        }
+    }
+
+    static PrimitiveType type_of(const Hittable &object)
+    {
+        if (dynamic_cast<const Sphere *>(&object))
+            return PrimitiveType::Sphere;
+        if (dynamic_cast<const Quad *>(&object))
+            return PrimitiveType::Quad;
+        if (dynamic_cast<const Triangle *>(&object))
+            return PrimitiveType::Triangle;
+        if (dynamic_cast<const Box *>(&object))
+            return PrimitiveType::Box;
+        if (dynamic_cast<const Instance *>(&object))
+            return PrimitiveType::Instance;
+        if (dynamic_cast<const ConstantMedium *>(&object))
+            return PrimitiveType::Medium;
+        return PrimitiveType::Other;
+    }
+
+    bool empty() const { return references.empty(); }
+
+    bool hit(std::uint32_t reference, const Ray &r, Interval t_range, HitRecord &rec) const
+    {
+        const std::uint32_t packed = references[reference];
+        const std::uint32_t index = packed & index_mask;
+        switch (static_cast<PrimitiveType>(packed >> type_shift))
+        {
+        case PrimitiveType::Sphere:
+            return spheres[index].hit(r, t_range, rec);
+        case PrimitiveType::Quad:
+            return quads[index].hit(r, t_range, rec);
+        case PrimitiveType::Triangle:
+            return triangles[index].hit(r, t_range, rec);
+        case PrimitiveType::Box:
+            return boxes[index].hit(r, t_range, rec);
+        case PrimitiveType::Instance:
+            return instances[index].hit(r, t_range, rec);
+        case PrimitiveType::Medium:
+            return media[index].hit(r, t_range, rec);
+        default:
+            return others[index]->hit(r, t_range, rec);
+        }
+    }
+
+    // First step of a closest-hit query. A hit on a sphere, quad, triangle
+    // or box only sets `rec.t` and keeps what is needed to rebuild it in
+    // `nearest`; an instance leaves its object-space hit in `rec`; media and
+    // other objects fill `rec` completely. Once the traversal is done,
+    // `compute_surface_interaction` finishes the nearest hit alone.
+    bool intersect(std::uint32_t reference, const Ray &r, Interval t_range, PrimitiveHit &nearest, HitRecord &rec) const
+    {
+        const std::uint32_t packed = references[reference];
+        const std::uint32_t index = packed & index_mask;
+        PrimitiveHit hit;
+        bool found;
+        switch (static_cast<PrimitiveType>(packed >> type_shift))
+        {
+        case PrimitiveType::Sphere:
+            found = spheres[index].intersect(r, t_range, hit);
+            break;
+        case PrimitiveType::Quad:
+            found = quads[index].intersect(r, t_range, hit);
+            break;
+        case PrimitiveType::Triangle:
+            found = triangles[index].intersect(r, t_range, hit);
+            break;
+        case PrimitiveType::Box:
+            found = boxes[index].intersect(r, t_range, hit);
+            break;
+        case PrimitiveType::Instance:
+            if (!instances[index].intersect(r, t_range, rec))
+                return false;
+            nearest.t = rec.t;
+            nearest.primitive = reference;
+            return true;
+        case PrimitiveType::Medium:
+            if (!media[index].hit(r, t_range, rec))
+                return false;
+            nearest.t = rec.t;
+            nearest.primitive = complete;
+            return true;
+        default:
+            if (!others[index]->hit(r, t_range, rec))
+                return false;
+            nearest.t = rec.t;
+            nearest.primitive = complete;
+            return true;
+        }
+        if (!found)
+            return false;
+        nearest = hit;
+        nearest.primitive = reference;
+        rec.t = hit.t;
+        return true;
+    }
+
+    void compute_surface_interaction(const Ray &r, const PrimitiveHit &nearest, HitRecord &rec) const
+    {
+        if (nearest.primitive == complete)
+            return;
+        const std::uint32_t packed = references[nearest.primitive];
+        const std::uint32_t index = packed & index_mask;
+        switch (static_cast<PrimitiveType>(packed >> type_shift))
+        {
+        case PrimitiveType::Sphere:
+            spheres[index].compute_surface_interaction(r, nearest, rec);
+            break;
+        case PrimitiveType::Quad:
+            quads[index].compute_surface_interaction(r, nearest, rec);
+            break;
+        case PrimitiveType::Triangle:
+            triangles[index].compute_surface_interaction(r, nearest, rec);
+            break;
+        case PrimitiveType::Box:
+            boxes[index].compute_surface_interaction(r, nearest, rec);
+            break;
+        case PrimitiveType::Instance:
+            instances[index].compute_surface_interaction(r, rec);
+            break;
+        default:
+            break;
+        }
+    }
+
+    bool occluded(std::uint32_t reference, const Ray &r, Interval t_range) const
+    {
+        const std::uint32_t packed = references[reference];
+        const std::uint32_t index = packed & index_mask;
+        switch (static_cast<PrimitiveType>(packed >> type_shift))
+        {
+        case PrimitiveType::Sphere:
+            return spheres[index].occluded(r, t_range);
+        case PrimitiveType::Quad:
+            return quads[index].occluded(r, t_range);
+        case PrimitiveType::Triangle:
+            return triangles[index].occluded(r, t_range);
+        case PrimitiveType::Box:
+            return boxes[index].occluded(r, t_range);
+        case PrimitiveType::Instance:
+            return instances[index].occluded(r, t_range);
+        case PrimitiveType::Medium:
+            return media[index].occluded(r, t_range);
+        default:
+            return others[index]->occluded(r, t_range);
+        }
+    }
+
+    // Bytes taken by the typed arrays and the references.
+    size_t memory() const
+    {
+        return spheres.size() * sizeof(Sphere) + quads.size() * sizeof(Quad) + triangles.size() * sizeof(Triangle) +
+               boxes.size() * sizeof(Box) + instances.size() * sizeof(Instance) + media.size() * sizeof(ConstantMedium) +
+               others.size() * sizeof(others[0]) + references.size() * sizeof(std::uint32_t);
+    }
+
+private:
+    template <typename T>
+    static std::uint32_t append(std::vector<T> &array, const T &value, PrimitiveType type)
+    {
+        array.push_back(value);
+        return static_cast<std::uint32_t>(type) << type_shift | static_cast<std::uint32_t>(array.size() - 1);
+    }
+
+    std::uint32_t store(const std::shared_ptr<Hittable> &primitive)
+    {
+        const Hittable &object = *primitive;
+        switch (type_of(object))
+        {
+        case PrimitiveType::Sphere:
+            return append(spheres, static_cast<const Sphere &>(object), PrimitiveType::Sphere);
+        case PrimitiveType::Quad:
+            return append(quads, static_cast<const Quad &>(object), PrimitiveType::Quad);
+        case PrimitiveType::Triangle:
+            return append(triangles, static_cast<const Triangle &>(object), PrimitiveType::Triangle);
+        case PrimitiveType::Box:
+            return append(boxes, static_cast<const Box &>(object), PrimitiveType::Box);
+        case PrimitiveType::Instance:
+            return append(instances, static_cast<const Instance &>(object), PrimitiveType::Instance);
+        case PrimitiveType::Medium:
+            return append(media, static_cast<const ConstantMedium &>(object), PrimitiveType::Medium);
+        default:
+            return append(others, std::shared_ptr<const Hittable>(primitive), PrimitiveType::Other);
+        }
+    }
+};
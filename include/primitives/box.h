@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cmath>
+#include <utility>
+
+#include "math/vec3.h"
+#include "hittable.h"
+#include "aabb.h"
+#include "material.h"
+#include "common.h"
+
+// Axis-aligned box intersected with one slab test. Faces are parameterized
+// like the six quads the box used to be made of: x faces map (z, y), y faces
+// (x, z) and z faces (x, y) to (u, v). Rotated boxes are wrapped in an
+// `Instance`.
+struct Box final : public Hittable
+{
+    Point3 min;
+    Point3 max;
+    const Material *material;
+    AABB bbox;
+
+    Box(const Point3 &a, const Point3 &b, const Material *material)
+        : min(std::fmin(a.x, b.x), std::fmin(a.y, b.y), std::fmin(a.z, b.z)),
+          max(std::fmax(a.x, b.x), std::fmax(a.y, b.y), std::fmax(a.z, b.z)),
+          material(material), bbox(min, max)
+    {
+        // Same padding as `Quad`, so a flat box has bounds a ray can enter.
+        constexpr FloatType eps = static_cast<FloatType>(0.0001); // ensure non-zero extent
+        Point3 box_min = min;
+        Point3 box_max = max;
+        for (int a = 0; a < 3; ++a)
+        {
+            if (box_max[a] - box_min[a] < eps)
+            {
+                box_min[a] -= eps / static_cast<FloatType>(2.0);
+                box_max[a] += eps / static_cast<FloatType>(2.0);
+            }
+        }
+        bbox = AABB(box_min, box_max);
+    }
+
+    bool hit(const Ray &r, Interval t_range, HitRecord &hit_record) const override
+    {
+        PrimitiveHit hit;
+        if (!intersect(r, t_range, hit))
+            return false;
+        compute_surface_interaction(r, hit, hit_record);
+        return true;
+    }
+
+    bool occluded(const Ray &r, Interval t_range) const override
+    {
+        PrimitiveHit hit;
+        return intersect(r, t_range, hit);
+    }
+
+    // Distance to the first face crossed inside `t_range`, and that face:
+    // its axis, plus 3 for the face on the `min` side. A ray starting inside
+    // the box hits the face it leaves through.
+    bool intersect(const Ray &r, const Interval &t_range, PrimitiveHit &hit) const
+    {
+        FloatType t_near = -infinity_f;
+        FloatType t_far = infinity_f;
+        int near_axis = 0;
+        int far_axis = 0;
+        for (int a = 0; a < 3; ++a)
+        {
+            FloatType inv_d = one_f / r.direction[a];
+            FloatType t0 = (min[a] - r.origin[a]) * inv_d;
+            FloatType t1 = (max[a] - r.origin[a]) * inv_d;
+            if (inv_d < 0)
+                std::swap(t0, t1);
+            if (t0 > t_near)
+            {
+                t_near = t0;
+                near_axis = a;
+            }
+            if (t1 < t_far)
+            {
+                t_far = t1;
+                far_axis = a;
+            }
+        }
+        if (t_near > t_far)
+            return false;
+
+        FloatType t;
+        int axis;
+        bool entering;
+        if (t_range.surrounds(t_near))
+        {
+            t = t_near;
+            axis = near_axis;
+            entering = true;
+        }
+        else if (t_range.surrounds(t_far))
+        {
+            t = t_far;
+            axis = far_axis;
+            entering = false;
+        }
+        else
+        {
+            return false;
+        }
+        const bool min_side = (r.direction[axis] > 0) == entering;
+        hit = {t, zero_f, zero_f, 0, static_cast<std::uint32_t>(axis + (min_side ? 3 : 0))};
+        return true;
+    }
+
+    void compute_surface_interaction(const Ray &r, const PrimitiveHit &hit, HitRecord &hit_record) const
+    {
+        const int axis = static_cast<int>(hit.face % 3);
+        hit_record.t = hit.t;
+        hit_record.point = r.at(hit.t);
+        Vec3 outward_normal = Vec3::zero();
+        outward_normal[axis] = hit.face >= 3 ? -one_f : one_f;
+        hit_record.set_face_normal(r, outward_normal);
+        if (!material || material->needs_uv())
+        {
+            const int u_axis = axis == 0 ? 2 : 0;
+            const int v_axis = axis == 1 ? 2 : 1;
+            hit_record.u = (hit_record.point[u_axis] - min[u_axis]) / (max[u_axis] - min[u_axis]);
+            hit_record.v = (hit_record.point[v_axis] - min[v_axis]) / (max[v_axis] - min[v_axis]);
+        }
+        else
+        {
+            hit_record.u = hit_record.v = zero_f;
+        }
+        hit_record.material = material;
+    }
+
+    AABB bounding_box() const override { return bbox; }
+    AABB bounding_box(FloatType) const override { return bbox; }
+
+    bool clipped_bounding_box(const AABB &clip, AABB &box) const override
+    {
+        box = AABB::intersection(bbox, clip);
+        return true;
+    }
+};
@@ -7,7 +7,7 @@
 #include "material.h"
 #include "rand_utils.h"
 
-struct ConstantMedium : public Hittable
+struct ConstantMedium final : public Hittable
 {
     std::shared_ptr<Hittable> boundary;
     const Material *phase_function;
@@ -54,5 +54,6 @@ struct ConstantMedium : public Hittable
 
     AABB bounding_box() const override { return boundary->bounding_box(); }
     AABB bounding_box(FloatType time1) const override { return boundary->bounding_box(time1); }
+    AABB bounding_box_at(FloatType time) const override { return boundary->bounding_box_at(time); }
 };
 
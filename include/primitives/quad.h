@@ -8,7 +8,7 @@
 #include "material.h"
 #include "common.h"
 
-struct Quad : public Hittable
+struct Quad final : public Hittable
 {
     Point3 q;
     Vec3 u;
@@ -56,6 +56,23 @@ struct Quad : public Hittable
     }
 
     bool hit(const Ray &r, Interval t_range, HitRecord &hit_record) const override
+    {
+        PrimitiveHit hit;
+        if (!intersect(r, t_range, hit))
+            return false;
+        compute_surface_interaction(r, hit, hit_record);
+        return true;
+    }
+
+    bool occluded(const Ray &r, Interval t_range) const override
+    {
+        PrimitiveHit hit;
+        return intersect(r, t_range, hit);
+    }
+
+    // Ray distance and coordinates along `u` and `v` of the hit inside
+    // `t_range`, in `b1` and `b2`.
+    bool intersect(const Ray &r, const Interval &t_range, PrimitiveHit &hit) const
     {
         FloatType denom = Vec3::dot(normal, r.direction);
         if (std::fabs(denom) < 1e-8)
@@ -69,16 +86,35 @@ struct Quad : public Hittable
         FloatType beta = Vec3::dot(w, Vec3::cross(u, rvec));
         if (alpha < 0 || alpha > 1 || beta < 0 || beta > 1)
             return false;
-        hit_record.t = t;
-        hit_record.point = p;
-        hit_record.u = alpha;
-        hit_record.v = beta;
+        hit = {t, alpha, beta, 0, 0};
+        return true;
+    }
+
+    void compute_surface_interaction(const Ray &r, const PrimitiveHit &hit, HitRecord &hit_record) const
+    {
+        hit_record.t = hit.t;
+        hit_record.point = r.at(hit.t);
+        hit_record.u = hit.b1;
+        hit_record.v = hit.b2;
         hit_record.material = material;
         hit_record.set_face_normal(r, normal);
-        return true;
     }
 
     AABB bounding_box() const override { return bbox; }
     AABB bounding_box(FloatType) const override { return bbox; }
+
+    bool clipped_bounding_box(const AABB &clip, AABB &box) const override
+    {
+        Point3 vertices[4] = {q, q + u, q + u + v, q + v};
+        box = AABB::clip_polygon(vertices, 4, clip);
+        return true;
+    }
+
+    void hash_geometry(ContentHash &hash, FloatType, FloatType) const override
+    {
+        hash.add(q);
+        hash.add(u);
+        hash.add(v);
+    }
 };
 
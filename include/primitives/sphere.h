@@ -4,9 +4,10 @@
 
 #include "math/vec3.h"
 #include "hittable.h"
+#include "material.h"
 #include "common.h"
 
-struct Sphere : public Hittable
+struct Sphere final : public Hittable
 {
     Point3 center;
     FloatType radius;
@@ -16,6 +17,22 @@ struct Sphere : public Hittable
         : center(center), radius(std::fmax(radius, FloatType(0))), material(material) {}
 
     bool hit(const Ray &r, Interval t_range, HitRecord &hit_record) const override
+    {
+        PrimitiveHit hit;
+        if (!intersect(r, t_range, hit))
+            return false;
+        compute_surface_interaction(r, hit, hit_record);
+        return true;
+    }
+
+    bool occluded(const Ray &r, Interval t_range) const override
+    {
+        PrimitiveHit hit;
+        return intersect(r, t_range, hit);
+    }
+
+    // Nearest root of the ray-sphere equation inside `t_range`.
+    bool intersect(const Ray &r, const Interval &t_range, PrimitiveHit &hit) const
     {
         Vec3 oc = r.origin - center;
         FloatType a = r.direction.squared_norm();
@@ -32,13 +49,23 @@ struct Sphere : public Hittable
             if (!t_range.surrounds(root))
                 return false;
         }
-        hit_record.t = root;
-        hit_record.point = r.at(hit_record.t);
+        hit.t = root;
+        return true;
+    }
+
+    // The trigonometry of the UV mapping only runs for materials that read
+    // it.
+    void compute_surface_interaction(const Ray &r, const PrimitiveHit &hit, HitRecord &hit_record) const
+    {
+        hit_record.t = hit.t;
+        hit_record.point = r.at(hit.t);
         Vec3 outward_normal = (hit_record.point - center) / radius;
         hit_record.set_face_normal(r, outward_normal);
-        get_sphere_uv(outward_normal, hit_record.u, hit_record.v);
+        if (!material || material->needs_uv())
+            get_sphere_uv(outward_normal, hit_record.u, hit_record.v);
+        else
+            hit_record.u = hit_record.v = zero_f;
         hit_record.material = material;
-        return true;
     }
 
     AABB bounding_box() const override
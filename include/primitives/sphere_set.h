@@ -0,0 +1,313 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "math/vec3.h"
+#include "hittable.h"
+#include "aabb.h"
+#include "bvh.h"
+#include "cpu_features.h"
+#include "primitives/sphere.h"
+#include "common.h"
+
+#if defined(RT_X86_64)
+#include <immintrin.h>
+#endif
+
+// Static spheres stored as structure-of-arrays, with their own BVH. The
+// arrays are kept in leaf order, so a leaf is a contiguous run of up to
+// `leaf_size` spheres that a ray is tested against four or eight at a time.
+// A sphere costs its center, radius and a material index instead of a
+// `Sphere` object reached through a pointer and a virtual call.
+struct SphereSet : public Hittable
+{
+    enum class Kernel
+    {
+        Scalar,
+        AVX,
+        AVX512,
+    };
+
+    static constexpr int leaf_size = 8;
+
+    std::vector<FloatType> center_x;
+    std::vector<FloatType> center_y;
+    std::vector<FloatType> center_z;
+    std::vector<FloatType> radius;
+    std::vector<std::uint32_t> material_index; // into `materials`
+    std::vector<const Material *> materials;   // distinct materials of the set
+    BVH bvh; // leaf references are positions in the arrays above
+    Kernel kernel;
+
+    // Sphere `i` has `centers[i]`, `radii[i]` and `sphere_materials[i]`.
+    // The median builder makes single-sphere leaves, so it is replaced by
+    // the SAH builder, which is told that a leaf of up to `leaf_size`
+    // spheres costs one test.
+    SphereSet(const std::vector<Point3> &centers, const std::vector<FloatType> &radii,
+              const std::vector<const Material *> &sphere_materials, Kernel kernel = best_kernel(),
+              BVHBuildOptions options = BVHBuildOptions())
+        : bvh(std::vector<BVH::MotionBox>(), zero_f, zero_f, options), kernel(kernel)
+    {
+        if (options.builder == BVHBuilder::Median)
+            options.builder = BVHBuilder::SAH;
+        options.max_leaf_size = leaf_size;
+        options.leaf_width = leaf_size;
+
+        std::vector<BVH::MotionBox> boxes(centers.size(), BVH::MotionBox{AABB::empty(), AABB::empty()});
+        for (size_t i = 0; i < centers.size(); ++i)
+        {
+            AABB box = sphere_box(centers[i], std::fmax(radii[i], zero_f));
+            boxes[i] = {box, box};
+        }
+        bvh = BVH(boxes, zero_f, zero_f, options);
+
+        std::unordered_map<const Material *, std::uint32_t> material_slots;
+        const size_t count = bvh.indices.size();
+        center_x.resize(count);
+        center_y.resize(count);
+        center_z.resize(count);
+        radius.resize(count);
+        material_index.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const std::uint32_t source = bvh.indices[i];
+            center_x[i] = centers[source].x;
+            center_y[i] = centers[source].y;
+            center_z[i] = centers[source].z;
+            radius[i] = std::fmax(radii[source], zero_f);
+            auto [slot, inserted] = material_slots.try_emplace(sphere_materials[source], static_cast<std::uint32_t>(materials.size()));
+            if (inserted)
+                materials.push_back(sphere_materials[source]);
+            material_index[i] = slot->second;
+        }
+    }
+
+    size_t sphere_count() const { return radius.size(); }
+
+    bool hit(const Ray &r, Interval t_range, HitRecord &hit_record) const override
+    {
+        const FloatType a = r.direction.squared_norm();
+        const FloatType inv_a = one_f / a;
+        std::uint32_t nearest_sphere = 0;
+        if (!bvh.traverse_leaves(r, t_range, hit_record, [&](std::uint32_t first, std::uint32_t count, const Interval &range, HitRecord &record)
+        {
+            alignas(64) FloatType t[leaf_size];
+            int mask = intersect(first, count, r, a, inv_a, range, t);
+            if (mask == 0)
+                return 0;
+
+            int nearest = std::countr_zero(static_cast<unsigned>(mask));
+            for (mask &= mask - 1; mask != 0; mask &= mask - 1)
+            {
+                int i = std::countr_zero(static_cast<unsigned>(mask));
+                if (t[i] < t[nearest])
+                    nearest = i;
+            }
+            nearest_sphere = first + nearest;
+            record.t = t[nearest];
+            return 1;
+        }))
+            return false;
+        fill_record(nearest_sphere, r, hit_record.t, hit_record);
+        return true;
+    }
+
+    bool occluded(const Ray &r, Interval t_range) const override
+    {
+        const FloatType a = r.direction.squared_norm();
+        const FloatType inv_a = one_f / a;
+        return bvh.traverse_leaves_any(r, t_range, [&](std::uint32_t first, std::uint32_t count, const Interval &range)
+        {
+            alignas(64) FloatType t[leaf_size];
+            return intersect(first, count, r, a, inv_a, range, t) != 0;
+        });
+    }
+
+    AABB bounding_box() const override { return bvh.bounding_box(); }
+    AABB bounding_box(FloatType) const override { return bvh.bounding_box(); }
+
+    void hash_geometry(ContentHash &hash, FloatType, FloatType) const override
+    {
+        hash.add(static_cast<std::uint64_t>(sphere_count()));
+        hash.add(center_x.data(), center_x.size() * sizeof(FloatType));
+        hash.add(center_y.data(), center_y.size() * sizeof(FloatType));
+        hash.add(center_z.data(), center_z.size() * sizeof(FloatType));
+        hash.add(radius.data(), radius.size() * sizeof(FloatType));
+    }
+
+    // Bytes taken by the sphere and BVH arrays.
+    size_t memory() const
+    {
+        return sphere_count() * (4 * sizeof(FloatType) + sizeof(std::uint32_t)) + materials.size() * sizeof(const Material *) +
+               bvh.node_memory() + bvh.indices.size() * sizeof(std::uint32_t);
+    }
+
+    static Kernel best_kernel()
+    {
+        if (CpuFeatures::supports_avx512f())
+            return Kernel::AVX512;
+        if (CpuFeatures::supports_avx())
+            return Kernel::AVX;
+        return Kernel::Scalar;
+    }
+
+    static const char *kernel_name(Kernel kernel)
+    {
+        switch (kernel)
+        {
+        case Kernel::AVX:
+            return "AVX";
+        case Kernel::AVX512:
+            return "AVX-512";
+        default:
+            return "scalar";
+        }
+    }
+
+private:
+    static AABB sphere_box(const Point3 &center, FloatType radius)
+    {
+        Vec3 r_vec(radius, radius, radius);
+        return AABB(center - r_vec, center + r_vec);
+    }
+
+    // Returns a mask of the spheres `first + i`, i below `count`, with a root
+    // inside `t_range`, and writes the nearest such root of each to `t[i]`.
+    // The arithmetic is that of `Sphere::hit`, except that all roots are
+    // scaled by `inv_a`. A negative discriminant gives NaN roots, which fail
+    // the range test.
+    int intersect(std::uint32_t first, std::uint32_t count, const Ray &r, FloatType a, FloatType inv_a, const Interval &t_range, FloatType *t) const
+    {
+#if defined(RT_X86_64)
+        if constexpr (std::is_same_v<FloatType, double>)
+        {
+            switch (kernel)
+            {
+            case Kernel::AVX512:
+                return intersect_avx512(first, count, r, a, inv_a, t_range, t);
+            case Kernel::AVX:
+                return intersect_avx(first, count, r, a, inv_a, t_range, t);
+            default:
+                break;
+            }
+        }
+#endif
+        return intersect_scalar(first, count, r, a, inv_a, t_range, t);
+    }
+
+    int intersect_scalar(std::uint32_t first, std::uint32_t count, const Ray &r, FloatType a, FloatType inv_a, const Interval &t_range, FloatType *t) const
+    {
+        int mask = 0;
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+            const size_t s = first + i;
+            const Vec3 oc(r.origin.x - center_x[s], r.origin.y - center_y[s], r.origin.z - center_z[s]);
+            const FloatType half_b = Vec3::dot(r.direction, oc);
+            const FloatType c = oc.squared_norm() - radius[s] * radius[s];
+            const FloatType discriminant = half_b * half_b - a * c;
+            if (discriminant < 0)
+                continue;
+            const FloatType sqrt_d = std::sqrt(discriminant);
+            const FloatType near = (-half_b - sqrt_d) * inv_a;
+            const FloatType far = (-half_b + sqrt_d) * inv_a;
+            if (t_range.surrounds(near))
+                t[i] = near;
+            else if (t_range.surrounds(far))
+                t[i] = far;
+            else
+                continue;
+            mask |= 1 << i;
+        }
+        return mask;
+    }
+
+#if defined(RT_X86_64)
+    RT_TARGET_AVX int intersect_avx(std::uint32_t first, std::uint32_t count, const Ray &r, FloatType a, FloatType inv_a, const Interval &t_range, FloatType *t) const
+    {
+        const __m256d lane = _mm256_set_pd(3, 2, 1, 0);
+        int mask = 0;
+        for (std::uint32_t base = 0; base < count; base += 4)
+        {
+            // Lanes past the leaf are not loaded and end up with no root.
+            const __m256i valid = _mm256_castpd_si256(_mm256_cmp_pd(lane, _mm256_set1_pd(static_cast<double>(count - base)), _CMP_LT_OQ));
+            const size_t s = first + base;
+            const __m256d ocx = _mm256_sub_pd(_mm256_set1_pd(r.origin.x), _mm256_maskload_pd(&center_x[s], valid));
+            const __m256d ocy = _mm256_sub_pd(_mm256_set1_pd(r.origin.y), _mm256_maskload_pd(&center_y[s], valid));
+            const __m256d ocz = _mm256_sub_pd(_mm256_set1_pd(r.origin.z), _mm256_maskload_pd(&center_z[s], valid));
+            const __m256d rad = _mm256_maskload_pd(&radius[s], valid);
+            const __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(r.direction.x), ocx),
+                                                               _mm256_mul_pd(_mm256_set1_pd(r.direction.y), ocy)),
+                                                 _mm256_mul_pd(_mm256_set1_pd(r.direction.z), ocz));
+            const __m256d oc2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+            const __m256d c = _mm256_sub_pd(oc2, _mm256_mul_pd(rad, rad));
+            const __m256d discriminant = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(_mm256_set1_pd(a), c));
+            const __m256d real = _mm256_and_pd(_mm256_cmp_pd(discriminant, _mm256_setzero_pd(), _CMP_GE_OQ), _mm256_castsi256_pd(valid));
+            if (_mm256_movemask_pd(real) == 0)
+                continue;
+
+            const __m256d sqrt_d = _mm256_sqrt_pd(discriminant);
+            const __m256d minus_half_b = _mm256_sub_pd(_mm256_setzero_pd(), half_b);
+            const __m256d near = _mm256_mul_pd(_mm256_sub_pd(minus_half_b, sqrt_d), _mm256_set1_pd(inv_a));
+            const __m256d far = _mm256_mul_pd(_mm256_add_pd(minus_half_b, sqrt_d), _mm256_set1_pd(inv_a));
+            const __m256d t_min = _mm256_set1_pd(t_range.min);
+            const __m256d t_max = _mm256_set1_pd(t_range.max);
+            const __m256d near_in = _mm256_and_pd(_mm256_cmp_pd(near, t_min, _CMP_GT_OQ), _mm256_cmp_pd(near, t_max, _CMP_LT_OQ));
+            const __m256d far_in = _mm256_and_pd(_mm256_cmp_pd(far, t_min, _CMP_GT_OQ), _mm256_cmp_pd(far, t_max, _CMP_LT_OQ));
+            _mm256_store_pd(t + base, _mm256_blendv_pd(far, near, near_in));
+            mask |= _mm256_movemask_pd(_mm256_and_pd(_mm256_or_pd(near_in, far_in), real)) << base;
+        }
+        return mask;
+    }
+
+    RT_TARGET_AVX512 int intersect_avx512(std::uint32_t first, std::uint32_t count, const Ray &r, FloatType a, FloatType inv_a, const Interval &t_range, FloatType *t) const
+    {
+        static_assert(leaf_size == 8, "the AVX-512 kernel tests a whole leaf at once");
+        const __mmask8 valid = static_cast<__mmask8>((1u << count) - 1);
+        const __m512d ocx = _mm512_sub_pd(_mm512_set1_pd(r.origin.x), _mm512_maskz_loadu_pd(valid, &center_x[first]));
+        const __m512d ocy = _mm512_sub_pd(_mm512_set1_pd(r.origin.y), _mm512_maskz_loadu_pd(valid, &center_y[first]));
+        const __m512d ocz = _mm512_sub_pd(_mm512_set1_pd(r.origin.z), _mm512_maskz_loadu_pd(valid, &center_z[first]));
+        const __m512d rad = _mm512_maskz_loadu_pd(valid, &radius[first]);
+        const __m512d half_b = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(_mm512_set1_pd(r.direction.x), ocx),
+                                                           _mm512_mul_pd(_mm512_set1_pd(r.direction.y), ocy)),
+                                             _mm512_mul_pd(_mm512_set1_pd(r.direction.z), ocz));
+        const __m512d oc2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)), _mm512_mul_pd(ocz, ocz));
+        const __m512d c = _mm512_sub_pd(oc2, _mm512_mul_pd(rad, rad));
+        const __m512d discriminant = _mm512_sub_pd(_mm512_mul_pd(half_b, half_b), _mm512_mul_pd(_mm512_set1_pd(a), c));
+        const __mmask8 real = _mm512_mask_cmp_pd_mask(valid, discriminant, _mm512_setzero_pd(), _CMP_GE_OQ);
+        if (real == 0)
+            return 0;
+
+        const __m512d sqrt_d = _mm512_maskz_sqrt_pd(real, discriminant);
+        const __m512d minus_half_b = _mm512_sub_pd(_mm512_setzero_pd(), half_b);
+        const __m512d near = _mm512_mul_pd(_mm512_sub_pd(minus_half_b, sqrt_d), _mm512_set1_pd(inv_a));
+        const __m512d far = _mm512_mul_pd(_mm512_add_pd(minus_half_b, sqrt_d), _mm512_set1_pd(inv_a));
+        const __m512d t_min = _mm512_set1_pd(t_range.min);
+        const __m512d t_max = _mm512_set1_pd(t_range.max);
+        const __mmask8 near_in = _mm512_mask_cmp_pd_mask(_mm512_mask_cmp_pd_mask(real, near, t_min, _CMP_GT_OQ), near, t_max, _CMP_LT_OQ);
+        const __mmask8 far_in = _mm512_mask_cmp_pd_mask(_mm512_mask_cmp_pd_mask(real, far, t_min, _CMP_GT_OQ), far, t_max, _CMP_LT_OQ);
+        _mm512_store_pd(t, _mm512_mask_mov_pd(far, near_in, near));
+        return near_in | far_in;
+    }
+#endif
+
+    void fill_record(size_t s, const Ray &r, FloatType t, HitRecord &hit_record) const
+    {
+        const Point3 center(center_x[s], center_y[s], center_z[s]);
+        hit_record.t = t;
+        hit_record.point = r.at(t);
+        Vec3 outward_normal = (hit_record.point - center) / radius[s];
+        hit_record.set_face_normal(r, outward_normal);
+        const Material *material = materials[material_index[s]];
+        if (!material || material->needs_uv())
+            Sphere::get_sphere_uv(outward_normal, hit_record.u, hit_record.v);
+        else
+            hit_record.u = hit_record.v = zero_f;
+        hit_record.material = material;
+    }
+};
@@ -8,7 +8,7 @@
 #include "material.h"
 #include "common.h"
 
-struct Triangle : public Hittable
+struct Triangle final : public Hittable
 {
     Point3 p0;
     Point3 p1;
@@ -51,6 +51,23 @@ struct Triangle : public Hittable
     }
 
     bool hit(const Ray &r, Interval t_range, HitRecord &hit_record) const override
+    {
+        PrimitiveHit hit;
+        if (!intersect(r, t_range, hit))
+            return false;
+        compute_surface_interaction(r, hit, hit_record);
+        return true;
+    }
+
+    bool occluded(const Ray &r, Interval t_range) const override
+    {
+        PrimitiveHit hit;
+        return intersect(r, t_range, hit);
+    }
+
+    // Ray distance and barycentrics of `p1` and `p2` of the hit inside
+    // `t_range`, in `b1` and `b2`.
+    bool intersect(const Ray &r, const Interval &t_range, PrimitiveHit &hit) const
     {
         FloatType denom = Vec3::dot(normal, r.direction);
         if (std::fabs(denom) < 1e-8)
@@ -78,16 +95,35 @@ struct Triangle : public Hittable
         FloatType u = one_f - v - w;
         if (u < 0 || v < 0 || w < 0)
             return false;
-        hit_record.t = t;
-        hit_record.point = p;
-        hit_record.u = v;
-        hit_record.v = w;
+        hit = {t, v, w, 0, 0};
+        return true;
+    }
+
+    void compute_surface_interaction(const Ray &r, const PrimitiveHit &hit, HitRecord &hit_record) const
+    {
+        hit_record.t = hit.t;
+        hit_record.point = r.at(hit.t);
+        hit_record.u = hit.b1;
+        hit_record.v = hit.b2;
         hit_record.material = material;
         hit_record.set_face_normal(r, normal);
-        return true;
     }
 
     AABB bounding_box() const override { return bbox; }
     AABB bounding_box(FloatType) const override { return bbox; }
+
+    bool clipped_bounding_box(const AABB &clip, AABB &box) const override
+    {
+        Point3 vertices[3] = {p0, p1, p2};
+        box = AABB::clip_polygon(vertices, 3, clip);
+        return true;
+    }
+
+    void hash_geometry(ContentHash &hash, FloatType, FloatType) const override
+    {
+        hash.add(p0);
+        hash.add(p1);
+        hash.add(p2);
+    }
 };
 
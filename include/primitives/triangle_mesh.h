@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "math/vec3.h"
+#include "hittable.h"
+#include "aabb.h"
+#include "bvh.h"
+#include "material.h"
+#include "common.h"
+
+// Indexed triangle mesh. Vertices are stored once and shared by the
+// triangles that use them, and the mesh keeps its own BVH whose leaves refer
+// to triangles by index, so a triangle costs three indices instead of a
+// `Triangle` object with its own pointer in the scene BVH.
+//
+// The arrays are views into `storage`, which is either owned by the mesh or
+// a memory-mapped file whose blobs are used in place.
+//
+// Intersection uses the watertight test of Woop, Benthin and Wald (2013):
+// rays shared by two triangles hit exactly one of them, never neither.
+struct TriangleMesh : public Hittable
+{
+    struct UV
+    {
+        FloatType u;
+        FloatType v;
+    };
+
+    std::span<const Point3> positions;
+    std::span<const Vec3> normals;          // per vertex, or empty for flat shading
+    std::span<const UV> uvs;                // per vertex, or empty to report barycentrics
+    std::span<const std::uint32_t> indices; // three vertex indices per triangle
+    std::shared_ptr<const void> storage;    // keeps the arrays above alive
+    const Material *material;
+    BVH bvh; // leaves reference triangles through `bvh.indices`
+
+    // Takes ownership of the arrays and builds the BVH.
+    TriangleMesh(std::vector<Point3> positions, std::vector<std::uint32_t> indices, const Material *material,
+                 std::vector<Vec3> normals = {}, std::vector<UV> uvs = {},
+                 const BVHBuildOptions &options = BVHBuildOptions())
+        : material(material), bvh(std::vector<BVH::MotionBox>(), zero_f, zero_f, options)
+    {
+        auto arrays = std::make_shared<OwnedArrays>(OwnedArrays{std::move(positions), std::move(normals), std::move(uvs), std::move(indices)});
+        this->positions = arrays->positions;
+        this->normals = arrays->normals;
+        this->uvs = arrays->uvs;
+        this->indices = arrays->indices;
+        storage = std::move(arrays);
+
+        std::vector<BVH::MotionBox> boxes(triangle_count(), BVH::MotionBox{AABB::empty(), AABB::empty()});
+        for (size_t i = 0; i < boxes.size(); ++i)
+        {
+            AABB box = triangle_box(i);
+            boxes[i] = {box, box};
+        }
+        // The mesh does not move, so the tree is built for a single instant.
+        bvh = BVH(boxes, zero_f, zero_f, options);
+    }
+
+    // Uses arrays that live in `storage` as they are, with a BVH built
+    // earlier over the same triangles.
+    TriangleMesh(std::shared_ptr<const void> storage, std::span<const Point3> positions, std::span<const std::uint32_t> indices,
+                 std::span<const Vec3> normals, std::span<const UV> uvs, const Material *material, BVH bvh)
+        : positions(positions), normals(normals), uvs(uvs), indices(indices), storage(std::move(storage)),
+          material(material), bvh(std::move(bvh)) {}
+
+    size_t triangle_count() const { return indices.size() / 3; }
+
+    bool hit(const Ray &r, Interval t_range, HitRecord &hit_record) const override
+    {
+        const Shear shear = Shear::of(r);
+        std::uint32_t nearest_triangle = 0;
+        Barycentrics nearest;
+        if (!bvh.traverse(r, t_range, hit_record, [&](std::uint32_t reference, const Interval &range, HitRecord &record)
+        {
+            Barycentrics hit;
+            if (!intersect_triangle(bvh.indices[reference], r, shear, range, hit))
+                return false;
+            nearest_triangle = bvh.indices[reference];
+            nearest = hit;
+            record.t = hit.t;
+            return true;
+        }))
+            return false;
+        compute_surface_interaction(nearest_triangle, r, nearest, hit_record);
+        return true;
+    }
+
+    bool occluded(const Ray &r, Interval t_range) const override
+    {
+        const Shear shear = Shear::of(r);
+        return bvh.traverse_any(r, t_range, [&](std::uint32_t reference, const Interval &range)
+        {
+            Barycentrics hit;
+            return intersect_triangle(bvh.indices[reference], r, shear, range, hit);
+        });
+    }
+
+    AABB bounding_box() const override { return bvh.bounding_box(); }
+    AABB bounding_box(FloatType) const override { return bvh.bounding_box(); }
+
+    void hash_geometry(ContentHash &hash, FloatType, FloatType) const override
+    {
+        hash.add(static_cast<std::uint64_t>(positions.size()));
+        for (const Point3 &p : positions)
+            hash.add(p);
+        hash.add(indices.data(), indices.size() * sizeof(std::uint32_t));
+    }
+
+    // Bytes taken by the vertex, index and BVH arrays.
+    size_t memory() const
+    {
+        return positions.size() * sizeof(Point3) + normals.size() * sizeof(Vec3) + uvs.size() * sizeof(UV) +
+               indices.size() * sizeof(std::uint32_t) + bvh.node_memory() + bvh.indices.size() * sizeof(std::uint32_t);
+    }
+
+private:
+    struct OwnedArrays
+    {
+        std::vector<Point3> positions;
+        std::vector<Vec3> normals;
+        std::vector<UV> uvs;
+        std::vector<std::uint32_t> indices;
+    };
+
+    struct Shear
+    {
+        int kx;
+        int ky;
+        int kz;
+        FloatType sx;
+        FloatType sy;
+        FloatType sz;
+
+        // Permute the axes so the ray travels along +z, then shear it onto
+        // the z axis. The shear depends only on the ray and is shared by all
+        // triangles it is tested against.
+        static Shear of(const Ray &r)
+        {
+            int kz = 0;
+            for (int a = 1; a < 3; ++a)
+            {
+                if (std::fabs(r.direction[a]) > std::fabs(r.direction[kz]))
+                    kz = a;
+            }
+            int kx = kz == 2 ? 0 : kz + 1;
+            int ky = kx == 2 ? 0 : kx + 1;
+            if (r.direction[kz] < 0)
+                std::swap(kx, ky);
+            return {kx, ky, kz, r.direction[kx] / r.direction[kz], r.direction[ky] / r.direction[kz], one_f / r.direction[kz]};
+        }
+    };
+
+    struct Barycentrics
+    {
+        FloatType t;
+        FloatType b0;
+        FloatType b1;
+        FloatType b2;
+    };
+
+    // Same padding as `Triangle`, so flat triangles have boxes a ray can
+    // enter. Every box also grows by a relative margin far above rounding
+    // error, since a hit exactly on a vertex or edge lies on the box boundary
+    // and the slab test could otherwise reject it.
+    AABB triangle_box(size_t triangle) const
+    {
+        const Point3 &p0 = positions[indices[3 * triangle + 0]];
+        const Point3 &p1 = positions[indices[3 * triangle + 1]];
+        const Point3 &p2 = positions[indices[3 * triangle + 2]];
+        Point3 min(std::fmin(std::fmin(p0.x, p1.x), p2.x), std::fmin(std::fmin(p0.y, p1.y), p2.y), std::fmin(std::fmin(p0.z, p1.z), p2.z));
+        Point3 max(std::fmax(std::fmax(p0.x, p1.x), p2.x), std::fmax(std::fmax(p0.y, p1.y), p2.y), std::fmax(std::fmax(p0.z, p1.z), p2.z));
+        constexpr FloatType eps = static_cast<FloatType>(0.0001); // ensure non-zero extent
+        for (int a = 0; a < 3; ++a)
+        {
+            if (max[a] - min[a] < eps)
+            {
+                min[a] -= eps / static_cast<FloatType>(2.0);
+                max[a] += eps / static_cast<FloatType>(2.0);
+            }
+            FloatType margin = std::max(std::fabs(min[a]), std::fabs(max[a])) * static_cast<FloatType>(1e-9);
+            min[a] -= margin;
+            max[a] += margin;
+        }
+        return AABB(min, max);
+    }
+
+    // Distance and normalized barycentrics of the hit, without touching a
+    // hit record; shared by `hit` and `occluded`.
+    bool intersect_triangle(std::uint32_t triangle, const Ray &r, const Shear &s, const Interval &t_range, Barycentrics &hit) const
+    {
+        const Vec3 a = positions[indices[3 * triangle + 0]] - r.origin;
+        const Vec3 b = positions[indices[3 * triangle + 1]] - r.origin;
+        const Vec3 c = positions[indices[3 * triangle + 2]] - r.origin;
+
+        // Vertices in the sheared frame, where the ray is the z axis.
+        const FloatType ax = a[s.kx] - s.sx * a[s.kz];
+        const FloatType ay = a[s.ky] - s.sy * a[s.kz];
+        const FloatType bx = b[s.kx] - s.sx * b[s.kz];
+        const FloatType by = b[s.ky] - s.sy * b[s.kz];
+        const FloatType cx = c[s.kx] - s.sx * c[s.kz];
+        const FloatType cy = c[s.ky] - s.sy * c[s.kz];
+
+        // Scaled barycentrics are 2D edge functions; a ray through an edge
+        // or vertex gets an exact zero, which counts as inside.
+        const FloatType u = cx * by - cy * bx;
+        const FloatType v = ax * cy - ay * cx;
+        const FloatType w = bx * ay - by * ax;
+        if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+            return false;
+        const FloatType det = u + v + w;
+        if (det == zero_f)
+            return false;
+
+        const FloatType t_scaled = u * s.sz * a[s.kz] + v * s.sz * b[s.kz] + w * s.sz * c[s.kz];
+        const FloatType t = t_scaled / det;
+        if (!t_range.surrounds(t))
+            return false;
+
+        const FloatType inv_det = one_f / det;
+        hit = {t, u * inv_det, v * inv_det, w * inv_det};
+        return true;
+    }
+
+    // Runs once per query, for the nearest triangle.
+    void compute_surface_interaction(std::uint32_t triangle, const Ray &r, const Barycentrics &hit, HitRecord &hit_record) const
+    {
+        const std::uint32_t i0 = indices[3 * triangle + 0];
+        const std::uint32_t i1 = indices[3 * triangle + 1];
+        const std::uint32_t i2 = indices[3 * triangle + 2];
+        const FloatType b0 = hit.b0;
+        const FloatType b1 = hit.b1;
+        const FloatType b2 = hit.b2;
+
+        hit_record.t = hit.t;
+        hit_record.point = r.at(hit.t);
+        if (uvs.empty() || (material && !material->needs_uv()))
+        {
+            hit_record.u = b1;
+            hit_record.v = b2;
+        }
+        else
+        {
+            hit_record.u = b0 * uvs[i0].u + b1 * uvs[i1].u + b2 * uvs[i2].u;
+            hit_record.v = b0 * uvs[i0].v + b1 * uvs[i1].v + b2 * uvs[i2].v;
+        }
+        hit_record.material = material;
+
+        // The side is decided by the geometric normal; vertex normals only
+        // change the shading direction.
+        const Vec3 geometric_normal = Vec3::normalize(Vec3::cross(positions[i1] - positions[i0], positions[i2] - positions[i0]));
+        hit_record.set_face_normal(r, geometric_normal);
+        if (!normals.empty())
+        {
+            Vec3 shading_normal = Vec3::normalize(b0 * normals[i0] + b1 * normals[i1] + b2 * normals[i2]);
+            hit_record.normal = hit_record.front_face ? shading_normal : -shading_normal;
+        }
+    }
+};
@@ -0,0 +1,354 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "bvh.h"
+#include "wide_bvh.h"
+
+// Wide BVH with compressed nodes for scenes whose tree would not fit in
+// memory at full precision. Each node stores a single-precision frame, an
+// origin and a per-axis step, and its children's bounds as `Quantum`
+// integers (8 or 16 bits) counted in steps from the origin. Child minima are
+// rounded down and maxima up, so a quantized box always contains the exact
+// one and traversal stays correct, only testing a few more nodes.
+//
+// Built from a binary BVH through the same collapse as `WideBVH`. Moving
+// children are bounded over the whole shutter interval instead of being
+// interpolated by ray time.
+template <int Width, typename Quantum>
+struct QuantizedBVH : public Hittable
+{
+    static_assert(Width == 4 || Width == 8, "QuantizedBVH supports 4 or 8 children per node");
+    static_assert(std::is_same_v<Quantum, std::uint8_t> || std::is_same_v<Quantum, std::uint16_t>,
+                  "QuantizedBVH stores child bounds in 8 or 16 bits");
+
+    static constexpr Quantum max_quantum = std::numeric_limits<Quantum>::max();
+
+    struct Node
+    {
+        float origin[3]; // frame origin, at or below the minimum of all children
+        float scale[3];  // size of one quantization step per axis
+        Quantum bounds[2][3][Width]; // [min/max][axis][child], in steps from `origin`
+        std::uint32_t child[Width];  // node index, or first primitive of a leaf child
+        std::uint16_t count[Width];  // primitives in a leaf child, 0 for interior and empty children
+        std::uint8_t child_count;
+    };
+
+    std::vector<Node> nodes;
+    std::shared_ptr<const PrimitiveTable> table; // leaf references, shared with the source BVH
+    AABB box;
+    BVH::MotionBox root_motion;
+    bool motion;
+    FloatType time0;
+    FloatType time1;
+
+    explicit QuantizedBVH(const BVH &bvh)
+        : box(bvh.bounding_box()),
+          root_motion(bvh.motion_boxes.empty() ? BVH::MotionBox{box, box} : bvh.motion_boxes[0]),
+          motion(!bvh.motion_boxes.empty()), time0(bvh.time0), time1(bvh.time1)
+    {
+        if (bvh.nodes.empty())
+            return;
+        WideBVH<Width> wide(bvh, WideBVH<Width>::Kernel::Scalar);
+        table = std::move(wide.table);
+        nodes.reserve(wide.nodes.size());
+        for (size_t i = 0; i < wide.nodes.size(); ++i)
+            nodes.push_back(quantize(wide.nodes[i], wide.motion_nodes.empty() ? nullptr : &wide.motion_nodes[i]));
+    }
+
+    bool hit(const Ray &r, Interval t_range, HitRecord &rec) const override
+    {
+        if (nodes.empty())
+            return false;
+
+        FloatType origin[3];
+        FloatType inv_direction[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            origin[a] = r.origin[a];
+            inv_direction[a] = one_f / r.direction[a];
+        }
+
+        StackEntry stack[stack_capacity];
+        int top = 0;
+        stack[top++] = {0, 0, t_range.min};
+        bool hit_anything = false;
+        RayCounters counters;
+        const PrimitiveTable &leaves = *table;
+        PrimitiveHit nearest;
+
+        while (top > 0)
+        {
+            StackEntry entry = stack[--top];
+            if (entry.t_near >= t_range.max)
+                continue;
+
+            if (entry.count > 0)
+            {
+                for (std::uint32_t i = 0; i < entry.count; ++i)
+                {
+                    if (leaves.intersect(entry.index + i, r, t_range, nearest, rec))
+                    {
+                        hit_anything = true;
+                        t_range.max = rec.t;
+                        if constexpr (RayStats::enabled)
+                            ++counters.primitive_hits;
+                    }
+                }
+                if constexpr (RayStats::enabled)
+                    counters.primitive_tests += entry.count;
+                continue;
+            }
+
+            if constexpr (RayStats::enabled)
+                ++counters.nodes_visited;
+            const Node &node = nodes[entry.index];
+            FloatType near[Width];
+            int mask = intersect_children(node, origin, inv_direction, t_range, near);
+
+            // Push hit children far to near so the nearest one is visited first.
+            int first = top;
+            for (int i = 0; i < node.child_count; ++i)
+            {
+                if (!(mask & (1 << i)))
+                    continue;
+                StackEntry child{node.child[i], node.count[i], near[i]};
+                int j = top++;
+                while (j > first && stack[j - 1].t_near < child.t_near)
+                {
+                    stack[j] = stack[j - 1];
+                    --j;
+                }
+                stack[j] = child;
+            }
+        }
+
+        if constexpr (RayStats::enabled)
+        {
+            counters.traversals = 1;
+            RayStats::record(counters);
+        }
+        if (hit_anything)
+            leaves.compute_surface_interaction(r, nearest, rec);
+        return hit_anything;
+    }
+
+    bool occluded(const Ray &r, Interval t_range) const override
+    {
+        if (nodes.empty())
+            return false;
+
+        FloatType origin[3];
+        FloatType inv_direction[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            origin[a] = r.origin[a];
+            inv_direction[a] = one_f / r.direction[a];
+        }
+
+        StackEntry stack[stack_capacity];
+        int top = 0;
+        stack[top++] = {0, 0, t_range.min};
+        bool hit_anything = false;
+        RayCounters counters;
+        const PrimitiveTable &leaves = *table;
+
+        while (top > 0 && !hit_anything)
+        {
+            StackEntry entry = stack[--top];
+            if (entry.count > 0)
+            {
+                for (std::uint32_t i = 0; i < entry.count; ++i)
+                {
+                    if (leaves.occluded(entry.index + i, r, t_range))
+                    {
+                        hit_anything = true;
+                        if constexpr (RayStats::enabled)
+                            ++counters.primitive_hits;
+                        break;
+                    }
+                }
+                // Per leaf, like `hit` and the binary BVH.
+                if constexpr (RayStats::enabled)
+                    counters.primitive_tests += entry.count;
+                continue;
+            }
+
+            if constexpr (RayStats::enabled)
+                ++counters.nodes_visited;
+            const Node &node = nodes[entry.index];
+            FloatType near[Width];
+            int mask = intersect_children(node, origin, inv_direction, t_range, near);
+            for (int i = 0; i < node.child_count; ++i)
+            {
+                if (mask & (1 << i))
+                    stack[top++] = {node.child[i], node.count[i], near[i]};
+            }
+        }
+
+        if constexpr (RayStats::enabled)
+        {
+            counters.traversals = 1;
+            RayStats::record(counters);
+        }
+        return hit_anything;
+    }
+
+    AABB bounding_box() const override { return box; }
+    AABB bounding_box(FloatType) const override { return box; }
+
+    AABB bounding_box_at(FloatType time) const override
+    {
+        if (!motion || time1 <= time0)
+            return box;
+        return root_motion.at(std::clamp((time - time0) / (time1 - time0), zero_f, one_f));
+    }
+
+    // Bytes taken by the node array. The full-precision `WideBVH` of the
+    // same tree has the same node count.
+    size_t node_memory() const { return nodes.size() * sizeof(Node); }
+
+private:
+    // Every level of the source tree adds at most Width - 1 pending entries.
+    static constexpr int stack_capacity = 64 * (Width - 1) + 1;
+
+    struct StackEntry
+    {
+        std::uint32_t index;
+        std::uint32_t count;
+        FloatType t_near;
+    };
+
+    // A float step times a quantum of at most 16 bits is exact in double
+    // precision, so this rounds once and gives the same result whether or
+    // not the compiler fuses it, during the build and during traversal.
+    static FloatType dequantize(const Node &node, int axis, Quantum q)
+    {
+        return static_cast<FloatType>(node.origin[axis]) + static_cast<FloatType>(q) * static_cast<FloatType>(node.scale[axis]);
+    }
+
+    // Slab test of every child box; bit i of the result is set when child i
+    // is hit within `t_range`, and `near[i]` is where the ray enters it.
+    static int intersect_children(const Node &node, const FloatType *origin, const FloatType *inv_direction, const Interval &t_range, FloatType *near)
+    {
+        FloatType far[Width];
+        for (int i = 0; i < Width; ++i)
+        {
+            near[i] = t_range.min;
+            far[i] = t_range.max;
+        }
+        for (int a = 0; a < 3; ++a)
+        {
+            for (int i = 0; i < Width; ++i)
+            {
+                FloatType t0 = (dequantize(node, a, node.bounds[0][a][i]) - origin[a]) * inv_direction[a];
+                FloatType t1 = (dequantize(node, a, node.bounds[1][a][i]) - origin[a]) * inv_direction[a];
+                near[i] = std::max(near[i], std::min(t0, t1));
+                far[i] = std::min(far[i], std::max(t0, t1));
+            }
+        }
+        int mask = 0;
+        for (int i = 0; i < node.child_count; ++i)
+        {
+            if (near[i] < far[i])
+                mask |= 1 << i;
+        }
+        return mask;
+    }
+
+    static Node quantize(const typename WideBVH<Width>::Node &wide, const typename WideBVH<Width>::MotionNode *wide_motion)
+    {
+        Node node;
+        node.child_count = wide.child_count;
+        for (int i = 0; i < Width; ++i)
+        {
+            node.child[i] = wide.child[i];
+            node.count[i] = wide.count[i];
+        }
+
+        for (int a = 0; a < 3; ++a)
+        {
+            // Child bounds over the shutter interval, which contain the
+            // interpolated bounds at any ray time.
+            FloatType lo[Width];
+            FloatType hi[Width];
+            FloatType frame_lo = infinity_f;
+            FloatType frame_hi = -infinity_f;
+            for (int i = 0; i < node.child_count; ++i)
+            {
+                lo[i] = wide.bounds[0][a][i];
+                hi[i] = wide.bounds[1][a][i];
+                if (wide_motion)
+                {
+                    lo[i] = std::min(lo[i], wide_motion->bounds[0][a][i]);
+                    hi[i] = std::max(hi[i], wide_motion->bounds[1][a][i]);
+                }
+                frame_lo = std::min(frame_lo, lo[i]);
+                frame_hi = std::max(frame_hi, hi[i]);
+            }
+
+            node.origin[a] = round_down(frame_lo);
+            FloatType extent = frame_hi - static_cast<FloatType>(node.origin[a]);
+            node.scale[a] = round_up(extent / max_quantum);
+            while (dequantize(node, a, max_quantum) < frame_hi)
+                node.scale[a] = std::nextafter(node.scale[a], std::numeric_limits<float>::infinity());
+
+            for (int i = 0; i < Width; ++i)
+            {
+                if (i >= node.child_count)
+                {
+                    // Empty slots; traversal only reads slots below
+                    // `child_count`, whatever the kernels report for these.
+                    node.bounds[0][a][i] = max_quantum;
+                    node.bounds[1][a][i] = 0;
+                    continue;
+                }
+                node.bounds[0][a][i] = quantize_down(node, a, lo[i]);
+                node.bounds[1][a][i] = quantize_up(node, a, hi[i]);
+            }
+        }
+        return node;
+    }
+
+    static float round_down(FloatType value)
+    {
+        float f = static_cast<float>(value);
+        return static_cast<FloatType>(f) > value ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static float round_up(FloatType value)
+    {
+        float f = static_cast<float>(value);
+        return static_cast<FloatType>(f) < value ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+
+    // Largest step whose dequantized value does not exceed `value`.
+    static Quantum quantize_down(const Node &node, int axis, FloatType value)
+    {
+        if (node.scale[axis] <= 0.0f)
+            return 0;
+        FloatType steps = std::floor((value - node.origin[axis]) / node.scale[axis]);
+        Quantum q = static_cast<Quantum>(std::clamp(steps, zero_f, static_cast<FloatType>(max_quantum)));
+        while (q > 0 && dequantize(node, axis, q) > value)
+            --q;
+        return q;
+    }
+
+    // Smallest step whose dequantized value is not below `value`.
+    static Quantum quantize_up(const Node &node, int axis, FloatType value)
+    {
+        if (node.scale[axis] <= 0.0f)
+            return 0;
+        FloatType steps = std::ceil((value - node.origin[axis]) / node.scale[axis]);
+        Quantum q = static_cast<Quantum>(std::clamp(steps, zero_f, static_cast<FloatType>(max_quantum)));
+        while (q < max_quantum && dequantize(node, axis, q) < value)
+            ++q;
+        return q;
+    }
+};
@@ -1,8 +1,14 @@
 #pragma once
 
+#include <cstdint>
+
 #include "common.h"
 #include "math/vec3.h"
 
+// Restarts the calling thread's generator from `seed`; other threads keep
+// their own, time-seeded generators.
+void seed_random(std::uint32_t seed);
+
 FloatType random_float(); // in [0,1)
 
 FloatType random_float(FloatType min, FloatType max); // in [min,max)
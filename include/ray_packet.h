@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include "common.h"
+#include "interval.h"
+#include "ray.h"
+
+// Structure-of-arrays copy of up to `max_size` coherent rays that traverse
+// an acceleration structure together. Boxes are tested against all lanes
+// in straight-line loops over the lane arrays, which the compiler turns into
+// SIMD code, and bit masks select the lanes that are still active.
+struct RayPacket
+{
+    static constexpr int max_size = 16;
+
+    int size;
+    FloatType origin[3][max_size];
+    FloatType inv_direction[3][max_size];
+    FloatType time[max_size];
+    FloatType shutter[max_size]; // fraction of the traversed structure's shutter interval at each lane's time
+    FloatType t_min;
+    FloatType t_max[max_size];   // closest hit so far per lane
+
+    RayPacket(const Ray *rays, int size, Interval t_range) : size(size), t_min(t_range.min)
+    {
+        // Unused lanes are still computed on, so they get finite values and
+        // an empty range.
+        for (int l = 0; l < max_size; ++l)
+        {
+            bool used = l < size;
+            for (int a = 0; a < 3; ++a)
+            {
+                origin[a][l] = used ? rays[l].origin[a] : zero_f;
+                inv_direction[a][l] = used ? one_f / rays[l].direction[a] : one_f;
+            }
+            time[l] = used ? rays[l].time : zero_f;
+            shutter[l] = zero_f;
+            t_max[l] = used ? t_range.max : t_range.min;
+        }
+    }
+
+    std::uint32_t all_lanes() const { return size >= 32 ? ~0u : (1u << size) - 1; }
+
+    void set_shutter(FloatType time0, FloatType time1)
+    {
+        for (int l = 0; l < size; ++l)
+            shutter[l] = time1 > time0 ? std::clamp((time[l] - time0) / (time1 - time0), zero_f, one_f) : zero_f;
+    }
+
+    // Lanes of `mask` whose ray enters the box within their current range.
+    // `nearest` receives the smallest entry distance among them.
+    std::uint32_t intersect(const FloatType lo[3], const FloatType hi[3], std::uint32_t mask, FloatType &nearest) const
+    {
+        if (size <= 4)
+            return intersect_lanes<4, false, true>(lo, hi, lo, hi, mask, &nearest);
+        if (size <= 8)
+            return intersect_lanes<8, false, true>(lo, hi, lo, hi, mask, &nearest);
+        return intersect_lanes<16, false, true>(lo, hi, lo, hi, mask, &nearest);
+    }
+
+    // As above for a box that moves from `lo0`/`hi0` to `lo1`/`hi1` over the
+    // shutter interval, interpolated to each lane's time.
+    std::uint32_t intersect(const FloatType lo0[3], const FloatType hi0[3], const FloatType lo1[3], const FloatType hi1[3],
+                            std::uint32_t mask, FloatType &nearest) const
+    {
+        if (size <= 4)
+            return intersect_lanes<4, true, true>(lo0, hi0, lo1, hi1, mask, &nearest);
+        if (size <= 8)
+            return intersect_lanes<8, true, true>(lo0, hi0, lo1, hi1, mask, &nearest);
+        return intersect_lanes<16, true, true>(lo0, hi0, lo1, hi1, mask, &nearest);
+    }
+
+    // The same tests without the reduction to the nearest entry, for
+    // traversals that do not order children by distance.
+    std::uint32_t intersect(const FloatType lo[3], const FloatType hi[3], std::uint32_t mask) const
+    {
+        if (size <= 4)
+            return intersect_lanes<4, false, false>(lo, hi, lo, hi, mask, nullptr);
+        if (size <= 8)
+            return intersect_lanes<8, false, false>(lo, hi, lo, hi, mask, nullptr);
+        return intersect_lanes<16, false, false>(lo, hi, lo, hi, mask, nullptr);
+    }
+
+    std::uint32_t intersect(const FloatType lo0[3], const FloatType hi0[3], const FloatType lo1[3], const FloatType hi1[3],
+                            std::uint32_t mask) const
+    {
+        if (size <= 4)
+            return intersect_lanes<4, true, false>(lo0, hi0, lo1, hi1, mask, nullptr);
+        if (size <= 8)
+            return intersect_lanes<8, true, false>(lo0, hi0, lo1, hi1, mask, nullptr);
+        return intersect_lanes<16, true, false>(lo0, hi0, lo1, hi1, mask, nullptr);
+    }
+
+private:
+    // The lane count is a compile-time constant so the loops vectorize.
+    template <int Lanes, bool Motion, bool Nearest>
+    std::uint32_t intersect_lanes(const FloatType lo0[3], const FloatType hi0[3], const FloatType lo1[3], const FloatType hi1[3],
+                                  std::uint32_t mask, FloatType *nearest) const
+    {
+        FloatType near[Lanes];
+        FloatType far[Lanes];
+        for (int l = 0; l < Lanes; ++l)
+        {
+            near[l] = t_min;
+            far[l] = t_max[l];
+        }
+        for (int a = 0; a < 3; ++a)
+        {
+            for (int l = 0; l < Lanes; ++l)
+            {
+                FloatType lo = lo0[a];
+                FloatType hi = hi0[a];
+                if constexpr (Motion)
+                {
+                    lo += shutter[l] * (lo1[a] - lo0[a]);
+                    hi += shutter[l] * (hi1[a] - hi0[a]);
+                }
+                FloatType t0 = (lo - origin[a][l]) * inv_direction[a][l];
+                FloatType t1 = (hi - origin[a][l]) * inv_direction[a][l];
+                near[l] = std::max(near[l], std::min(t0, t1));
+                far[l] = std::min(far[l], std::max(t0, t1));
+            }
+        }
+
+        std::uint32_t hits = 0;
+        for (int l = 0; l < Lanes; ++l)
+            hits |= static_cast<std::uint32_t>(near[l] < far[l]) << l;
+        hits &= mask;
+
+        if constexpr (Nearest)
+        {
+            *nearest = infinity_f;
+            for (int l = 0; l < Lanes; ++l)
+                *nearest = std::min(*nearest, (hits >> l) & 1 ? near[l] : infinity_f);
+        }
+        return hits;
+    }
+};
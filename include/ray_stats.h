@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(RT_BVH_STATS)
+#include <tbb/enumerable_thread_specific.h>
+#endif
+
+// Traversal counters of one or more rays. A BVH traversal counts into a
+// local instance and hands it to `RayStats::record` once it returns.
+struct RayCounters
+{
+    std::uint64_t traversals = 0;      // rays traced through a BVH; two-level traversals count their bottom-level rays too
+    std::uint64_t nodes_visited = 0;   // nodes whose bounds were tested
+    std::uint64_t primitive_tests = 0;
+    std::uint64_t primitive_hits = 0;  // tests that found a closer hit
+};
+
+// Per-ray traversal statistics, only collected when built with RT_BVH_STATS.
+// Otherwise `enabled` is false, the counting in the traversal loops sits
+// behind `if constexpr` and compiles away.
+namespace RayStats
+{
+#if defined(RT_BVH_STATS)
+    inline constexpr bool enabled = true;
+
+    // Each thread adds into its own slot, so recording takes no lock.
+    inline tbb::enumerable_thread_specific<RayCounters> per_thread;
+
+    inline void record(const RayCounters &counters)
+    {
+        RayCounters &total = per_thread.local();
+        total.traversals += counters.traversals;
+        total.nodes_visited += counters.nodes_visited;
+        total.primitive_tests += counters.primitive_tests;
+        total.primitive_hits += counters.primitive_hits;
+    }
+
+    inline RayCounters total()
+    {
+        RayCounters sum;
+        for (const RayCounters &counters : per_thread)
+        {
+            sum.traversals += counters.traversals;
+            sum.nodes_visited += counters.nodes_visited;
+            sum.primitive_tests += counters.primitive_tests;
+            sum.primitive_hits += counters.primitive_hits;
+        }
+        return sum;
+    }
+#else
+    inline constexpr bool enabled = false;
+
+    inline void record(const RayCounters &) {}
+
+    inline RayCounters total() { return RayCounters(); }
+#endif
+}
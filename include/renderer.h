@@ -1,10 +1,47 @@
 #pragma once
 
+#include <cmath>
 #include <cstdint>
 
 #include "camera.h"
-#include "hittable_list.h"
+#include "hittable.h"
+#include "material_table.h"
 #include "color.h"
+#include "rand_utils.h"
+
+// Primary rays of a pixel: the first floor(sqrt(spp))^2 samples are
+// stratified over the pixel, the rest are uniform.
+struct PixelSampler
+{
+    const Camera &camera;
+    int sqrt_spp;
+    int stratified_samples;
+    FloatType inv_sqrt_spp;
+    FloatType inv_image_width;
+    FloatType inv_image_height;
+
+    PixelSampler(const Camera &camera, int samples_per_pixel)
+        : camera(camera),
+          sqrt_spp(static_cast<int>(std::sqrt(samples_per_pixel))),
+          stratified_samples(sqrt_spp * sqrt_spp),
+          inv_sqrt_spp(one_f / static_cast<FloatType>(sqrt_spp)),
+          inv_image_width(one_f / camera.image_width),
+          inv_image_height(one_f / camera.image_height) {}
+
+    Ray sample(int i, int j, int sample) const
+    {
+        FloatType offset_u = random_float() - static_cast<FloatType>(0.5);
+        FloatType offset_v = random_float() - static_cast<FloatType>(0.5);
+        if (sample < stratified_samples)
+        {
+            offset_u = (static_cast<FloatType>(sample % sqrt_spp) + offset_u + static_cast<FloatType>(0.5)) * inv_sqrt_spp - static_cast<FloatType>(0.5);
+            offset_v = (static_cast<FloatType>(sample / sqrt_spp) + offset_v + static_cast<FloatType>(0.5)) * inv_sqrt_spp - static_cast<FloatType>(0.5);
+        }
+        FloatType u = (static_cast<FloatType>(i) + static_cast<FloatType>(0.5) + offset_u) * inv_image_width;
+        FloatType v = static_cast<FloatType>(1.0) - (static_cast<FloatType>(j) + static_cast<FloatType>(0.5) + offset_v) * inv_image_height; // flip v for image coordinates
+        return camera.get_ray(u, v);
+    }
+};
 
 class Renderer
 {
@@ -12,7 +49,8 @@ public:
     virtual ~Renderer() = default;
     virtual void render(
         const Camera &camera,
-        const HittableList &world,
+        const Hittable &world,
+        const MaterialTable &materials,
         const Color &background,
         std::uint8_t *buffer) const = 0;
 };
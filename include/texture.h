@@ -11,6 +11,10 @@
 struct Texture {
     virtual ~Texture() = default;
     virtual Color value(FloatType u, FloatType v, const Point3 &p) const = 0;
+    // Whether `value` reads `u` and `v`. Primitives skip computing them for
+    // surfaces whose textures do not. Textures defined elsewhere are assumed
+    // to.
+    virtual bool needs_uv() const { return true; }
 };
 
 struct SolidColorTexture : public Texture {
@@ -18,6 +22,7 @@ struct SolidColorTexture : public Texture {
     Color value(FloatType u, FloatType v, const Point3 &p) const override {
         return color_value;
     }
+    bool needs_uv() const override { return false; }
     Color color_value;
 };
 
@@ -28,6 +33,9 @@ struct CheckerTexture : public Texture {
         auto s = std::sin(scale * p.x) * std::sin(scale * p.y) * std::sin(scale * p.z);
         return s < 0 ? odd->value(u, v, p) : even->value(u, v, p);
     }
+    bool needs_uv() const override {
+        return even->needs_uv() || odd->needs_uv();
+    }
     std::unique_ptr<Texture> even;
     std::unique_ptr<Texture> odd;
     FloatType scale;
@@ -37,6 +45,7 @@ struct ImageTexture : public Texture {
     ImageTexture(const std::string &filename);
     ~ImageTexture();
     Color value(FloatType u, FloatType v, const Point3 &p) const override;
+    bool needs_uv() const override { return true; }
 
     unsigned char *data = nullptr;
     int width = 0;
@@ -49,6 +58,7 @@ struct NoiseTexture : public Texture {
     Color value(FloatType u, FloatType v, const Point3 &p) const override {
         return Color(1, 1, 1) * 0.5 * (1 + std::sin(scale * p.z + 10 * noise.turb(p)));
     }
+    bool needs_uv() const override { return false; }
     Perlin noise;
     FloatType scale;
 };
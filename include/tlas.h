@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "instance.h"
+
+// Two-level acceleration structure. Every unique geometry behind an
+// `Instance` is built once into a bottom-level structure (BLAS), and the top
+// level is a BVH over compact instance records that reference a BLAS by
+// index. Objects that are not instanced share one BLAS with an identity
+// record. Changing instance transforms only requires rebuilding the top
+// level, whose size is the instance count.
+//
+// Records store their affine in single precision, which acts as a slightly
+// different but exact transform: instance bounds are taken from the rounded
+// matrix, so they still enclose the geometry. Only the closest hit is
+// transformed back to world space.
+struct TLAS : public Hittable
+{
+    struct InstanceRecord
+    {
+        float world_to_object[3][4]; // affine inverse of the instance transform
+        float velocity[3];           // linear motion in world space
+        std::uint32_t blas;          // index into `blases`
+        const Material *material;    // replaces the materials of the BLAS when set
+        FloatType time0;             // time at which the transform applies unmoved
+    };
+
+    std::vector<std::shared_ptr<Hittable>> blases;
+    std::vector<InstanceRecord> instances;
+    BVH top; // over the instance boxes; leaves index `instances` through `top.indices`
+    BVHBuildOptions options;
+    FloatType time0;
+    FloatType time1;
+
+    TLAS(const std::vector<std::shared_ptr<Hittable>> &objects, FloatType time0, FloatType time1,
+         const BVHBuildOptions &options = BVHBuildOptions())
+        : top(std::vector<BVH::MotionBox>(), time0, time1, options), options(options), time0(time0), time1(time1)
+    {
+        std::unordered_map<const Hittable *, std::uint32_t> blas_of;
+        std::vector<std::shared_ptr<Hittable>> loose;
+        for (const auto &object : objects)
+        {
+            auto instance = std::dynamic_pointer_cast<Instance>(object);
+            if (!instance)
+            {
+                loose.push_back(object);
+                continue;
+            }
+            auto [it, inserted] = blas_of.try_emplace(instance->object.get(), static_cast<std::uint32_t>(blases.size()));
+            if (inserted)
+                blases.push_back(make_blas(instance->object));
+            instances.push_back(make_record(*instance->transform, it->second, instance->material));
+        }
+        if (!loose.empty())
+        {
+            blases.push_back(std::make_shared<BVH>(loose, time0, time1, options));
+            instances.push_back(make_record(Transform(), static_cast<std::uint32_t>(blases.size() - 1), nullptr));
+        }
+        rebuild();
+    }
+
+    // Replaces the transform of one instance. Call `rebuild` once all
+    // transforms of a frame are set.
+    void set_transform(size_t instance, const Transform &transform)
+    {
+        instances[instance] = make_record(transform, instances[instance].blas, instances[instance].material);
+    }
+
+    // Rebuilds the top level from the current instance transforms; the
+    // bottom-level structures are left untouched.
+    void rebuild()
+    {
+        top = BVH(instance_boxes(), time0, time1, options);
+    }
+
+    // Moves the structure to a new shutter interval, as for the next frame of
+    // an animation. Instance boxes are refitted into the top level, which is
+    // only rebuilt once refitting has degraded it too far; returns whether it
+    // was. Bottom-level BVHs are refitted too when their contents move.
+    bool update(FloatType new_time0, FloatType new_time1)
+    {
+        time0 = new_time0;
+        time1 = new_time1;
+        for (const auto &blas : blases)
+        {
+            auto bvh = std::dynamic_pointer_cast<BVH>(blas);
+            if (bvh && !bvh->motion_boxes.empty() && !bvh->refit(time0, time1))
+                *bvh = BVH(bvh->source_objects(), time0, time1, bvh->options);
+        }
+
+        std::vector<BVH::MotionBox> boxes = instance_boxes();
+        if (top.refit(boxes, time0, time1))
+            return false;
+        top = BVH(boxes, time0, time1, options);
+        return true;
+    }
+
+    bool hit(const Ray &r, Interval t_range, HitRecord &rec) const override
+    {
+        std::uint32_t nearest = 0;
+        bool hit_anything = top.traverse(r, t_range, rec, [&](std::uint32_t reference, const Interval &range, HitRecord &record)
+        {
+            const std::uint32_t index = top.indices[reference];
+            const InstanceRecord &instance = instances[index];
+            if (!blases[instance.blas]->hit(local_ray(instance, r), range, record))
+                return false;
+            nearest = index;
+            return true;
+        });
+        if (!hit_anything)
+            return false;
+
+        // The local ray keeps the parameterization of `r`, and normals map
+        // through the inverse transpose, which keeps them on the side the
+        // BLAS turned them to.
+        const InstanceRecord &instance = instances[nearest];
+        const auto &m = instance.world_to_object;
+        const Vec3 n = rec.normal;
+        rec.point = r.at(rec.t);
+        rec.normal = Vec3::normalize(Vec3(
+            m[0][0] * n.x + m[1][0] * n.y + m[2][0] * n.z,
+            m[0][1] * n.x + m[1][1] * n.y + m[2][1] * n.z,
+            m[0][2] * n.x + m[1][2] * n.y + m[2][2] * n.z));
+        if (instance.material)
+            rec.material = instance.material;
+        return true;
+    }
+
+    bool occluded(const Ray &r, Interval t_range) const override
+    {
+        return top.traverse_any(r, t_range, [&](std::uint32_t reference, const Interval &range)
+        {
+            const InstanceRecord &instance = instances[top.indices[reference]];
+            return blases[instance.blas]->occluded(local_ray(instance, r), range);
+        });
+    }
+
+    AABB bounding_box() const override { return top.bounding_box(); }
+    AABB bounding_box(FloatType t1) const override { return top.bounding_box(t1); }
+    AABB bounding_box_at(FloatType time) const override { return top.bounding_box_at(time); }
+
+private:
+    std::shared_ptr<Hittable> make_blas(const std::shared_ptr<Hittable> &object) const
+    {
+        // Lists get a BVH of their own; anything else, including a prebuilt
+        // BVH or a single primitive, is used as is.
+        if (auto list = std::dynamic_pointer_cast<HittableList>(object))
+            return std::make_shared<BVH>(list->objects, time0, time1, options);
+        return object;
+    }
+
+    // `r` in the object space of `instance`, with the parameterization of `r`.
+    static Ray local_ray(const InstanceRecord &instance, const Ray &r)
+    {
+        const auto &m = instance.world_to_object;
+        const FloatType dt = r.time - instance.time0;
+        const Point3 origin(r.origin.x - dt * instance.velocity[0], r.origin.y - dt * instance.velocity[1], r.origin.z - dt * instance.velocity[2]);
+        return Ray(
+            Point3(m[0][0] * origin.x + m[0][1] * origin.y + m[0][2] * origin.z + m[0][3],
+                   m[1][0] * origin.x + m[1][1] * origin.y + m[1][2] * origin.z + m[1][3],
+                   m[2][0] * origin.x + m[2][1] * origin.y + m[2][2] * origin.z + m[2][3]),
+            Vec3(m[0][0] * r.direction.x + m[0][1] * r.direction.y + m[0][2] * r.direction.z,
+                 m[1][0] * r.direction.x + m[1][1] * r.direction.y + m[1][2] * r.direction.z,
+                 m[2][0] * r.direction.x + m[2][1] * r.direction.y + m[2][2] * r.direction.z),
+            r.time);
+    }
+
+    static InstanceRecord make_record(const Transform &transform, std::uint32_t blas, const Material *material)
+    {
+        InstanceRecord record{};
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+                record.world_to_object[i][j] = static_cast<float>(transform.inverse.m[i][j]);
+            record.velocity[i] = static_cast<float>(transform.motion.linear[i]);
+        }
+        record.blas = blas;
+        record.material = material;
+        record.time0 = transform.time0;
+        return record;
+    }
+
+    // Transform that the rounded record applies, from object to world space.
+    static Mat4 object_to_world(const InstanceRecord &instance)
+    {
+        Mat4 world_to_object = Mat4::identity();
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+                world_to_object.m[i][j] = instance.world_to_object[i][j];
+        }
+        return world_to_object.inverse();
+    }
+
+    std::vector<BVH::MotionBox> instance_boxes() const
+    {
+        std::vector<BVH::MotionBox> boxes(instances.size(), BVH::MotionBox{AABB::empty(), AABB::empty()});
+        for (size_t i = 0; i < instances.size(); ++i)
+        {
+            const Mat4 m = object_to_world(instances[i]);
+            boxes[i] = {instance_box(instances[i], m, time0), instance_box(instances[i], m, time1)};
+        }
+        return boxes;
+    }
+
+    AABB instance_box(const InstanceRecord &instance, Mat4 m, FloatType time) const
+    {
+        const FloatType dt = time - instance.time0;
+        m.set_translation(m.get_translation() + Vec3(dt * instance.velocity[0], dt * instance.velocity[1], dt * instance.velocity[2]));
+        return transform_aabb(blases[instance.blas]->bounding_box_at(time), m);
+    }
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "renderer.h"
+#include "common.h"
+
+// Traces paths breadth-first instead of one at a time: a batch of camera
+// rays is intersected as a whole, the hits are grouped by the kind of their
+// `MaterialTable` entry and each group is shaded in one loop without
+// dispatch, and the rays that scatter form the next, compacted queue.
+// Produces the same estimate as `MyRenderer`.
+class WavefrontRenderer : public Renderer
+{
+public:
+    // `batch_size` bounds the number of paths in flight per worker thread.
+    WavefrontRenderer(int samples_per_pixel, int max_depth, FloatType gamma, int batch_size = 1 << 16)
+        : samples_per_pixel(samples_per_pixel), max_depth(max_depth), gamma(gamma), batch_size(batch_size) {}
+    void render(
+        const Camera &camera,
+        const Hittable &world,
+        const MaterialTable &materials,
+        const Color &background,
+        std::uint8_t *buffer) const override;
+private:
+    int samples_per_pixel;
+    int max_depth;
+    FloatType gamma;
+    int batch_size;
+};
@@ -0,0 +1,653 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "bvh.h"
+#include "cpu_features.h"
+
+#if defined(RT_X86_64)
+#include <immintrin.h>
+#endif
+
+// Collapsed BVH whose nodes hold up to `Width` children with their bounds in
+// structure-of-arrays form, so one ray is tested against all children of a
+// node with a few SIMD instructions. Built from a binary BVH.
+template <int Width>
+struct WideBVH : public Hittable
+{
+    static_assert(Width == 4 || Width == 8, "WideBVH supports 4 or 8 children per node");
+
+    enum class Kernel
+    {
+        Scalar,
+        SSE2,
+        AVX,
+        AVX512,
+    };
+
+    struct alignas(64) Node
+    {
+        FloatType bounds[2][3][Width]; // [min/max][axis][child]
+        std::uint32_t child[Width];    // node index, or first primitive of a leaf child
+        std::uint16_t count[Width];    // primitives in a leaf child, 0 for interior and empty children
+        std::uint8_t child_count;
+    };
+
+    // Child bounds at the end of the shutter interval. When present, the
+    // bounds in `Node` are those at its start.
+    struct alignas(64) MotionNode
+    {
+        FloatType bounds[2][3][Width];
+    };
+
+    std::vector<Node> nodes;
+    std::vector<MotionNode> motion_nodes; // parallel to `nodes`, empty for static scenes
+    std::shared_ptr<const PrimitiveTable> table; // leaf references, shared with the source BVH
+    Kernel kernel;
+    AABB box;
+    BVH::MotionBox root_motion;
+    FloatType time0;
+    FloatType time1;
+
+    explicit WideBVH(const BVH &bvh, Kernel kernel = best_kernel())
+        : table(bvh.table), kernel(kernel), box(bvh.bounding_box()),
+          root_motion(bvh.motion_boxes.empty() ? BVH::MotionBox{box, box} : bvh.motion_boxes[0]),
+          time0(bvh.time0), time1(bvh.time1)
+    {
+        if (bvh.nodes.empty())
+            return;
+        nodes.reserve(bvh.nodes.size() / (Width - 1) + 1);
+        if (!bvh.motion_boxes.empty())
+            motion_nodes.reserve(nodes.capacity());
+        collapse(bvh, 0);
+    }
+
+    bool hit(const Ray &r, Interval t_range, HitRecord &rec) const override
+    {
+        if (nodes.empty())
+            return false;
+
+        RayData ray;
+        for (int a = 0; a < 3; ++a)
+        {
+            ray.origin[a] = r.origin[a];
+            ray.inv_direction[a] = one_f / r.direction[a];
+        }
+        ray.shutter = motion_nodes.empty() ? zero_f : shutter_fraction(r.time);
+
+        StackEntry stack[stack_capacity];
+        int top = 0;
+        stack[top++] = {0, 0, t_range.min};
+        bool hit_anything = false;
+        RayCounters counters;
+        const PrimitiveTable &leaves = *table;
+        PrimitiveHit nearest;
+
+        while (top > 0)
+        {
+            StackEntry entry = stack[--top];
+            if (entry.t_near >= t_range.max)
+                continue;
+
+            if (entry.count > 0)
+            {
+                for (std::uint32_t i = 0; i < entry.count; ++i)
+                {
+                    if (leaves.intersect(entry.index + i, r, t_range, nearest, rec))
+                    {
+                        hit_anything = true;
+                        t_range.max = rec.t;
+                        if constexpr (RayStats::enabled)
+                            ++counters.primitive_hits;
+                    }
+                }
+                if constexpr (RayStats::enabled)
+                    counters.primitive_tests += entry.count;
+                continue;
+            }
+
+            if constexpr (RayStats::enabled)
+                ++counters.nodes_visited;
+            const Node &node = nodes[entry.index];
+            alignas(64) FloatType t_near[Width];
+            int mask = intersect_children(entry.index, ray, t_range, t_near);
+
+            // Push hit children far to near so the nearest one is visited first.
+            int first = top;
+            for (int i = 0; i < node.child_count; ++i)
+            {
+                if (!(mask & (1 << i)))
+                    continue;
+                StackEntry child{node.child[i], node.count[i], t_near[i]};
+                int j = top++;
+                while (j > first && stack[j - 1].t_near < child.t_near)
+                {
+                    stack[j] = stack[j - 1];
+                    --j;
+                }
+                stack[j] = child;
+            }
+        }
+
+        if constexpr (RayStats::enabled)
+        {
+            counters.traversals = 1;
+            RayStats::record(counters);
+        }
+        if (hit_anything)
+            leaves.compute_surface_interaction(r, nearest, rec);
+        return hit_anything;
+    }
+
+    // Children are pushed in the order they are stored; with no closest hit
+    // to shrink `t_range`, sorting them would not save any work.
+    bool occluded(const Ray &r, Interval t_range) const override
+    {
+        if (nodes.empty())
+            return false;
+
+        RayData ray;
+        for (int a = 0; a < 3; ++a)
+        {
+            ray.origin[a] = r.origin[a];
+            ray.inv_direction[a] = one_f / r.direction[a];
+        }
+        ray.shutter = motion_nodes.empty() ? zero_f : shutter_fraction(r.time);
+
+        StackEntry stack[stack_capacity];
+        int top = 0;
+        stack[top++] = {0, 0, t_range.min};
+        bool hit_anything = false;
+        RayCounters counters;
+        const PrimitiveTable &leaves = *table;
+
+        while (top > 0 && !hit_anything)
+        {
+            StackEntry entry = stack[--top];
+            if (entry.count > 0)
+            {
+                for (std::uint32_t i = 0; i < entry.count; ++i)
+                {
+                    if (leaves.occluded(entry.index + i, r, t_range))
+                    {
+                        hit_anything = true;
+                        if constexpr (RayStats::enabled)
+                            ++counters.primitive_hits;
+                        break;
+                    }
+                }
+                // Per leaf, like `hit` and the binary BVH.
+                if constexpr (RayStats::enabled)
+                    counters.primitive_tests += entry.count;
+                continue;
+            }
+
+            if constexpr (RayStats::enabled)
+                ++counters.nodes_visited;
+            const Node &node = nodes[entry.index];
+            alignas(64) FloatType t_near[Width];
+            int mask = intersect_children(entry.index, ray, t_range, t_near);
+            for (int i = 0; i < node.child_count; ++i)
+            {
+                if (mask & (1 << i))
+                    stack[top++] = {node.child[i], node.count[i], t_near[i]};
+            }
+        }
+
+        if constexpr (RayStats::enabled)
+        {
+            counters.traversals = 1;
+            RayStats::record(counters);
+        }
+        return hit_anything;
+    }
+
+    // Packets share the node traversal. Child boxes are tested for all active
+    // lanes at once, and hit children are visited in order of their nearest
+    // lane entry. As in `hit`, each lane completes the record of its nearest
+    // hit only once the traversal is done.
+    std::uint32_t hit_packet(const Ray *rays, int count, Interval t_range, HitRecord *hit_records) const override
+    {
+        if (nodes.empty())
+            return 0;
+        RayPacket packet(rays, count, t_range);
+        bool motion = !motion_nodes.empty();
+        if (motion)
+            packet.set_shutter(time0, time1);
+
+        struct PacketEntry
+        {
+            std::uint32_t index;
+            std::uint32_t count;
+            std::uint32_t mask;
+        };
+        PacketEntry stack[stack_capacity];
+        FloatType stack_near[stack_capacity];
+        int top = 0;
+        stack[top] = {0, 0, packet.all_lanes()};
+        stack_near[top++] = t_range.min;
+        std::uint32_t hits = 0;
+        PrimitiveHit nearest_hits[RayPacket::max_size]; // per lane, completed after the traversal
+        RayCounters counters;
+
+        while (top > 0)
+        {
+            --top;
+            PacketEntry entry = stack[top];
+
+            if (entry.count > 0)
+            {
+                for (std::uint32_t i = 0; i < entry.count; ++i)
+                {
+                    for (std::uint32_t lanes = entry.mask; lanes != 0; lanes &= lanes - 1)
+                    {
+                        int l = std::countr_zero(lanes);
+                        if (table->intersect(entry.index + i, rays[l], Interval(packet.t_min, packet.t_max[l]), nearest_hits[l], hit_records[l]))
+                        {
+                            hits |= 1u << l;
+                            packet.t_max[l] = hit_records[l].t;
+                            if constexpr (RayStats::enabled)
+                                ++counters.primitive_hits;
+                        }
+                        if constexpr (RayStats::enabled)
+                            ++counters.primitive_tests;
+                    }
+                }
+                continue;
+            }
+
+            if constexpr (RayStats::enabled)
+                ++counters.nodes_visited;
+            const Node &node = nodes[entry.index];
+            int first = top;
+            for (int i = 0; i < node.child_count; ++i)
+            {
+                FloatType lo[3] = {node.bounds[0][0][i], node.bounds[0][1][i], node.bounds[0][2][i]};
+                FloatType hi[3] = {node.bounds[1][0][i], node.bounds[1][1][i], node.bounds[1][2][i]};
+                FloatType nearest;
+                std::uint32_t mask;
+                if (motion)
+                {
+                    const MotionNode &end = motion_nodes[entry.index];
+                    FloatType lo1[3] = {end.bounds[0][0][i], end.bounds[0][1][i], end.bounds[0][2][i]};
+                    FloatType hi1[3] = {end.bounds[1][0][i], end.bounds[1][1][i], end.bounds[1][2][i]};
+                    mask = packet.intersect(lo, hi, lo1, hi1, entry.mask, nearest);
+                }
+                else
+                {
+                    mask = packet.intersect(lo, hi, entry.mask, nearest);
+                }
+                if (mask == 0)
+                    continue;
+
+                // Push far to near so the nearest child is popped first.
+                int j = top++;
+                while (j > first && stack_near[j - 1] < nearest)
+                {
+                    stack[j] = stack[j - 1];
+                    stack_near[j] = stack_near[j - 1];
+                    --j;
+                }
+                stack[j] = {node.child[i], node.count[i], mask};
+                stack_near[j] = nearest;
+            }
+        }
+
+        for (std::uint32_t lanes = hits; lanes != 0; lanes &= lanes - 1)
+        {
+            int l = std::countr_zero(lanes);
+            table->compute_surface_interaction(rays[l], nearest_hits[l], hit_records[l]);
+        }
+
+        if constexpr (RayStats::enabled)
+        {
+            counters.traversals = packet.size;
+            RayStats::record(counters);
+        }
+        return hits;
+    }
+
+    AABB bounding_box() const override { return box; }
+    AABB bounding_box(FloatType) const override { return box; }
+
+    AABB bounding_box_at(FloatType time) const override
+    {
+        if (motion_nodes.empty())
+            return box;
+        return root_motion.at(shutter_fraction(time));
+    }
+
+    static Kernel best_kernel()
+    {
+        if (Width == 8 && CpuFeatures::supports_avx512f())
+            return Kernel::AVX512;
+        if (CpuFeatures::supports_avx())
+            return Kernel::AVX;
+#if defined(RT_X86_64)
+        return Kernel::SSE2;
+#else
+        return Kernel::Scalar;
+#endif
+    }
+
+    // Bytes taken by the node arrays of a tree with `node_count` nodes.
+    static size_t node_memory(size_t node_count, bool motion)
+    {
+        return node_count * (sizeof(Node) + (motion ? sizeof(MotionNode) : 0));
+    }
+
+    size_t node_memory() const { return node_memory(nodes.size(), !motion_nodes.empty()); }
+
+    static const char *kernel_name(Kernel kernel)
+    {
+        switch (kernel)
+        {
+        case Kernel::SSE2:
+            return "SSE2";
+        case Kernel::AVX:
+            return "AVX";
+        case Kernel::AVX512:
+            return "AVX-512";
+        default:
+            return "scalar";
+        }
+    }
+
+private:
+    // Every level of the source tree adds at most Width - 1 pending entries.
+    static constexpr int stack_capacity = 64 * (Width - 1) + 1;
+
+    struct RayData
+    {
+        FloatType origin[3];
+        FloatType inv_direction[3];
+        FloatType shutter; // fraction of the shutter interval at the ray's time
+    };
+
+    FloatType shutter_fraction(FloatType time) const
+    {
+        if (time1 <= time0)
+            return zero_f;
+        return std::clamp((time - time0) / (time1 - time0), zero_f, one_f);
+    }
+
+    struct StackEntry
+    {
+        std::uint32_t index;
+        std::uint32_t count;
+        FloatType t_near;
+    };
+
+    std::uint32_t collapse(const BVH &bvh, std::uint32_t binary_index)
+    {
+        // Open the binary subtree until it yields Width children, always
+        // expanding the interior child with the largest surface area.
+        std::uint32_t children[Width];
+        int child_count = 0;
+        const BVH::Node &binary_node = bvh.nodes[binary_index];
+        if (binary_node.is_leaf())
+        {
+            children[child_count++] = binary_index;
+        }
+        else
+        {
+            children[child_count++] = binary_index + 1;
+            children[child_count++] = binary_node.offset;
+        }
+
+        while (child_count < Width)
+        {
+            int best = -1;
+            FloatType best_area = -infinity_f;
+            for (int i = 0; i < child_count; ++i)
+            {
+                const BVH::Node &candidate = bvh.nodes[children[i]];
+                if (!candidate.is_leaf() && candidate.box.surface_area() > best_area)
+                {
+                    best = i;
+                    best_area = candidate.box.surface_area();
+                }
+            }
+            if (best < 0)
+                break;
+            std::uint32_t opened = children[best];
+            children[best] = opened + 1;
+            children[child_count++] = bvh.nodes[opened].offset;
+        }
+
+        std::uint32_t node_index = static_cast<std::uint32_t>(nodes.size());
+        nodes.push_back(empty_node());
+        nodes[node_index].child_count = static_cast<std::uint8_t>(child_count);
+        bool motion = !bvh.motion_boxes.empty();
+        if (motion)
+            motion_nodes.push_back(empty_motion_node());
+
+        for (int i = 0; i < child_count; ++i)
+        {
+            const BVH::Node &child = bvh.nodes[children[i]];
+            std::uint32_t child_index = child.offset;
+            if (!child.is_leaf())
+                child_index = collapse(bvh, children[i]);
+
+            Node &node = nodes[node_index];
+            const AABB &box = motion ? bvh.motion_boxes[children[i]].start : child.box;
+            for (int a = 0; a < 3; ++a)
+            {
+                node.bounds[0][a][i] = box.axis(a).min;
+                node.bounds[1][a][i] = box.axis(a).max;
+            }
+            if (motion)
+            {
+                const AABB &end_box = bvh.motion_boxes[children[i]].end;
+                for (int a = 0; a < 3; ++a)
+                {
+                    motion_nodes[node_index].bounds[0][a][i] = end_box.axis(a).min;
+                    motion_nodes[node_index].bounds[1][a][i] = end_box.axis(a).max;
+                }
+            }
+            node.child[i] = child_index;
+            node.count[i] = child.count;
+        }
+        return node_index;
+    }
+
+    // Empty slots get finite bounds that interpolate to themselves at any
+    // time. A ray can still enter them, since the kernels order the slab
+    // distances per axis, so traversal only ever reads the hit mask and
+    // distances of slots below `child_count`.
+    static constexpr FloatType empty_bound = std::numeric_limits<FloatType>::max();
+
+    static MotionNode empty_motion_node()
+    {
+        MotionNode node;
+        for (int i = 0; i < Width; ++i)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                node.bounds[0][a][i] = empty_bound;
+                node.bounds[1][a][i] = -empty_bound;
+            }
+        }
+        return node;
+    }
+
+    static Node empty_node()
+    {
+        Node node;
+        for (int i = 0; i < Width; ++i)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                node.bounds[0][a][i] = empty_bound;
+                node.bounds[1][a][i] = -empty_bound;
+            }
+            node.child[i] = 0;
+            node.count[i] = 0;
+        }
+        node.child_count = 0;
+        return node;
+    }
+
+    int intersect_children(std::uint32_t index, const RayData &ray, const Interval &t_range, FloatType *t_near) const
+    {
+        const Node &node = nodes[index];
+        if (motion_nodes.empty())
+            return dispatch<false>(node, nullptr, ray, t_range, t_near);
+        return dispatch<true>(node, &motion_nodes[index], ray, t_range, t_near);
+    }
+
+    template <bool Motion>
+    int dispatch(const Node &node, const MotionNode *motion, const RayData &ray, const Interval &t_range, FloatType *t_near) const
+    {
+#if defined(RT_X86_64)
+        if constexpr (std::is_same_v<FloatType, double>)
+        {
+            switch (kernel)
+            {
+            case Kernel::AVX512:
+                if constexpr (Width == 8)
+                    return intersect_avx512<Motion>(node, motion, ray, t_range, t_near);
+                break;
+            case Kernel::AVX:
+                return intersect_avx<Motion>(node, motion, ray, t_range, t_near);
+            case Kernel::SSE2:
+                return intersect_sse2<Motion>(node, motion, ray, t_range, t_near);
+            default:
+                break;
+            }
+        }
+#endif
+        return intersect_scalar<Motion>(node, motion, ray, t_range, t_near);
+    }
+
+    // Each kernel returns a mask of the children whose slab interval overlaps
+    // `t_range` and writes the entry distance of every child to `t_near`.
+    // With motion, child bounds are first interpolated to the ray's time.
+
+    template <bool Motion>
+    static int intersect_scalar(const Node &node, const MotionNode *motion, const RayData &ray, const Interval &t_range, FloatType *t_near)
+    {
+        int mask = 0;
+        for (int i = 0; i < Width; ++i)
+        {
+            FloatType near = t_range.min;
+            FloatType far = t_range.max;
+            for (int a = 0; a < 3; ++a)
+            {
+                FloatType lo = node.bounds[0][a][i];
+                FloatType hi = node.bounds[1][a][i];
+                if constexpr (Motion)
+                {
+                    lo += ray.shutter * (motion->bounds[0][a][i] - lo);
+                    hi += ray.shutter * (motion->bounds[1][a][i] - hi);
+                }
+                FloatType t0 = (lo - ray.origin[a]) * ray.inv_direction[a];
+                FloatType t1 = (hi - ray.origin[a]) * ray.inv_direction[a];
+                near = std::max(near, std::min(t0, t1));
+                far = std::min(far, std::max(t0, t1));
+            }
+            t_near[i] = near;
+            mask |= (near < far) << i;
+        }
+        return mask;
+    }
+
+#if defined(RT_X86_64)
+    template <bool Motion>
+    static int intersect_sse2(const Node &node, const MotionNode *motion, const RayData &ray, const Interval &t_range, FloatType *t_near)
+    {
+        int mask = 0;
+        for (int base = 0; base < Width; base += 2)
+        {
+            __m128d near = _mm_set1_pd(t_range.min);
+            __m128d far = _mm_set1_pd(t_range.max);
+            for (int a = 0; a < 3; ++a)
+            {
+                __m128d lo = _mm_load_pd(&node.bounds[0][a][base]);
+                __m128d hi = _mm_load_pd(&node.bounds[1][a][base]);
+                if constexpr (Motion)
+                {
+                    __m128d shutter = _mm_set1_pd(ray.shutter);
+                    lo = _mm_add_pd(lo, _mm_mul_pd(shutter, _mm_sub_pd(_mm_load_pd(&motion->bounds[0][a][base]), lo)));
+                    hi = _mm_add_pd(hi, _mm_mul_pd(shutter, _mm_sub_pd(_mm_load_pd(&motion->bounds[1][a][base]), hi)));
+                }
+                __m128d origin = _mm_set1_pd(ray.origin[a]);
+                __m128d inv_direction = _mm_set1_pd(ray.inv_direction[a]);
+                __m128d t0 = _mm_mul_pd(_mm_sub_pd(lo, origin), inv_direction);
+                __m128d t1 = _mm_mul_pd(_mm_sub_pd(hi, origin), inv_direction);
+                near = _mm_max_pd(near, _mm_min_pd(t0, t1));
+                far = _mm_min_pd(far, _mm_max_pd(t0, t1));
+            }
+            _mm_store_pd(t_near + base, near);
+            mask |= _mm_movemask_pd(_mm_cmplt_pd(near, far)) << base;
+        }
+        return mask;
+    }
+
+    template <bool Motion>
+    RT_TARGET_AVX static int intersect_avx(const Node &node, const MotionNode *motion, const RayData &ray, const Interval &t_range, FloatType *t_near)
+    {
+        int mask = 0;
+        for (int base = 0; base < Width; base += 4)
+        {
+            __m256d near = _mm256_set1_pd(t_range.min);
+            __m256d far = _mm256_set1_pd(t_range.max);
+            for (int a = 0; a < 3; ++a)
+            {
+                __m256d lo = _mm256_load_pd(&node.bounds[0][a][base]);
+                __m256d hi = _mm256_load_pd(&node.bounds[1][a][base]);
+                if constexpr (Motion)
+                {
+                    __m256d shutter = _mm256_set1_pd(ray.shutter);
+                    lo = _mm256_add_pd(lo, _mm256_mul_pd(shutter, _mm256_sub_pd(_mm256_load_pd(&motion->bounds[0][a][base]), lo)));
+                    hi = _mm256_add_pd(hi, _mm256_mul_pd(shutter, _mm256_sub_pd(_mm256_load_pd(&motion->bounds[1][a][base]), hi)));
+                }
+                __m256d origin = _mm256_set1_pd(ray.origin[a]);
+                __m256d inv_direction = _mm256_set1_pd(ray.inv_direction[a]);
+                __m256d t0 = _mm256_mul_pd(_mm256_sub_pd(lo, origin), inv_direction);
+                __m256d t1 = _mm256_mul_pd(_mm256_sub_pd(hi, origin), inv_direction);
+                near = _mm256_max_pd(near, _mm256_min_pd(t0, t1));
+                far = _mm256_min_pd(far, _mm256_max_pd(t0, t1));
+            }
+            _mm256_store_pd(t_near + base, near);
+            mask |= _mm256_movemask_pd(_mm256_cmp_pd(near, far, _CMP_LT_OQ)) << base;
+        }
+        return mask;
+    }
+
+    template <bool Motion>
+    RT_TARGET_AVX512 static int intersect_avx512(const Node &node, const MotionNode *motion, const RayData &ray, const Interval &t_range, FloatType *t_near)
+    {
+        // Zero-masked min and max over all lanes: the unmasked forms merge
+        // into an undefined vector, which gcc reports as maybe uninitialized.
+        const __mmask8 all = 0xFF;
+        __m512d near = _mm512_set1_pd(t_range.min);
+        __m512d far = _mm512_set1_pd(t_range.max);
+        for (int a = 0; a < 3; ++a)
+        {
+            __m512d lo = _mm512_load_pd(&node.bounds[0][a][0]);
+            __m512d hi = _mm512_load_pd(&node.bounds[1][a][0]);
+            if constexpr (Motion)
+            {
+                __m512d shutter = _mm512_set1_pd(ray.shutter);
+                lo = _mm512_add_pd(lo, _mm512_mul_pd(shutter, _mm512_sub_pd(_mm512_load_pd(&motion->bounds[0][a][0]), lo)));
+                hi = _mm512_add_pd(hi, _mm512_mul_pd(shutter, _mm512_sub_pd(_mm512_load_pd(&motion->bounds[1][a][0]), hi)));
+            }
+            __m512d origin = _mm512_set1_pd(ray.origin[a]);
+            __m512d inv_direction = _mm512_set1_pd(ray.inv_direction[a]);
+            __m512d t0 = _mm512_mul_pd(_mm512_sub_pd(lo, origin), inv_direction);
+            __m512d t1 = _mm512_mul_pd(_mm512_sub_pd(hi, origin), inv_direction);
+            near = _mm512_maskz_max_pd(all, near, _mm512_maskz_min_pd(all, t0, t1));
+            far = _mm512_maskz_min_pd(all, far, _mm512_maskz_max_pd(all, t0, t1));
+        }
+        _mm512_store_pd(t_near, near);
+        return static_cast<int>(_mm512_cmp_pd_mask(near, far, _CMP_LT_OQ));
+    }
+#endif
+};
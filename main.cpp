@@ -1,8 +1,10 @@
 
 #include <vector>
 #include <memory>
+#include <algorithm>
 #include <chrono>
 #include <string>
+#include <optional>
 #include <sstream>
 #include <vector>
 
@@ -16,12 +18,73 @@
 #include "common.h"
 
 #include "scene/scene_factory.h"
+#include "mesh_loader.h"
+#include "mesh_file.h"
+#include "instance.h"
+#include "material_table.h"
 
 #include "my_renderer.h"
+#include "wavefront_renderer.h"
+#include "bvh.h"
+#include "bvh_cache.h"
+#include "bvh_stats.h"
+#include "wide_bvh.h"
+#include "quantized_bvh.h"
+#include "tlas.h"
+#include "cpu_features.h"
+#include "rand_utils.h"
 
 #include <tbb/global_control.h>
 #include <thread>
 
+FloatType to_mib(size_t bytes)
+{
+    return static_cast<FloatType>(bytes) / (1024 * 1024);
+}
+
+// Logs the node memory of a quantized layout next to what the
+// full-precision layout of the same width would take.
+template <int Width, typename Quantum>
+void log_quantized_bvh(const QuantizedBVH<Width, Quantum> &quantized)
+{
+    spdlog::info("Using BVH{} with {}-bit quantized bounds: {} nodes, {:.2f} MiB of nodes ({:.2f} MiB at full precision)",
+                 Width, 8 * sizeof(Quantum), quantized.nodes.size(), to_mib(quantized.node_memory()),
+                 to_mib(WideBVH<Width>::node_memory(quantized.nodes.size(), quantized.motion)));
+}
+
+// A mesh file listed under `meshes` in the config, with the material it is
+// rendered with and the scale and offset applied to its vertices.
+struct MeshEntry
+{
+    std::string path;
+    std::string material = "lambertian"; // lambertian, metal, dielectric or light
+    Color color = Color(0.8, 0.8, 0.8);
+    FloatType fuzz = zero_f;
+    FloatType refraction_index = static_cast<FloatType>(1.5);
+    FloatType scale = one_f;
+    Vec3 translate = Vec3::zero();
+};
+
+const Material *make_mesh_material(const MeshEntry &entry, Scene &scene)
+{
+    std::unique_ptr<Material> material;
+    if (entry.material == "metal")
+        material = std::make_unique<Metal>(entry.color, entry.fuzz);
+    else if (entry.material == "dielectric")
+        material = std::make_unique<Dielectric>(entry.refraction_index);
+    else
+    {
+        auto texture = std::make_unique<SolidColorTexture>(entry.color);
+        if (entry.material == "light")
+            material = std::make_unique<DiffuseLight>(texture.get());
+        else
+            material = std::make_unique<Lambertian>(texture.get());
+        scene.textures.push_back(std::move(texture));
+    }
+    scene.materials.push_back(std::move(material));
+    return scene.materials.back().get();
+}
+
 std::string format_duration(std::chrono::milliseconds duration)
 {
     auto total_ms = duration.count();
@@ -67,13 +130,93 @@ std::string format_duration(std::chrono::milliseconds duration)
     return oss.str();
 }
 
+// Parses an OBJ or PLY file into a new mesh, with the entry's scale and
+// offset baked into the vertices.
+std::shared_ptr<TriangleMesh> parse_mesh(const std::string &path, const Material *material, FloatType scale,
+                                         const Vec3 &translate, const BVHBuildOptions &bvh_options)
+{
+    auto load_start_time = std::chrono::high_resolution_clock::now();
+    auto mesh = MeshLoader::load(path);
+    auto load_end_time = std::chrono::high_resolution_clock::now();
+    if (!mesh)
+        return nullptr;
+    auto load_duration = std::chrono::duration_cast<std::chrono::microseconds>(load_end_time - load_start_time);
+    FloatType megabytes = static_cast<FloatType>(mesh->file_size) / 1e6;
+    spdlog::info("Loaded mesh {} in {}: {} vertices, {} triangles, {:.1f} MB at {:.0f} MB/s", path,
+                 format_duration(std::chrono::duration_cast<std::chrono::milliseconds>(load_duration)),
+                 mesh->positions.size(), mesh->indices.size() / 3, megabytes,
+                 megabytes / std::max(load_duration.count() * 1e-6, 1e-6));
+
+    for (Point3 &position : mesh->positions)
+        position = scale * position + translate;
+    auto build_start_time = std::chrono::high_resolution_clock::now();
+    auto triangle_mesh = std::make_shared<TriangleMesh>(std::move(mesh->positions), std::move(mesh->indices), material,
+                                                        std::move(mesh->normals), std::move(mesh->uvs), bvh_options);
+    auto build_end_time = std::chrono::high_resolution_clock::now();
+    spdlog::info("Mesh BVH built in {}: {} nodes, {:.2f} MiB for the whole mesh",
+                 format_duration(std::chrono::duration_cast<std::chrono::milliseconds>(build_end_time - build_start_time)),
+                 triangle_mesh->bvh.nodes.size(), to_mib(triangle_mesh->memory()));
+    return triangle_mesh;
+}
+
+// Adds the mesh of a config entry. A prebaked .rtmesh file is mapped with
+// its BVH as is; since its vertices cannot be rewritten in place, a scale or
+// offset puts it behind an `Instance`.
+std::shared_ptr<Hittable> load_mesh(const MeshEntry &entry, Scene &scene, const BVHBuildOptions &bvh_options)
+{
+    const Material *material = make_mesh_material(entry, scene);
+    if (!entry.path.ends_with(".rtmesh"))
+        return parse_mesh(entry.path, material, entry.scale, entry.translate, bvh_options);
+
+    auto map_start_time = std::chrono::high_resolution_clock::now();
+    auto mesh = MeshFile::load(entry.path, material);
+    auto map_end_time = std::chrono::high_resolution_clock::now();
+    if (!mesh)
+        return nullptr;
+    spdlog::info("Mapped mesh {} in {}: {} vertices, {} triangles, {} BVH nodes", entry.path,
+                 format_duration(std::chrono::duration_cast<std::chrono::milliseconds>(map_end_time - map_start_time)),
+                 mesh->positions.size(), mesh->triangle_count(), mesh->bvh.nodes.size());
+    if (entry.scale == one_f && entry.translate.x == zero_f && entry.translate.y == zero_f && entry.translate.z == zero_f)
+        return mesh;
+    auto transform = std::make_shared<Transform>(Mat4::translation(entry.translate) * Mat4::scale(Vec3(entry.scale, entry.scale, entry.scale)));
+    return std::make_shared<Instance>(mesh, transform);
+}
+
+// `ray_tracing convert <mesh.obj|mesh.ply> <mesh.rtmesh>`: parses a mesh,
+// builds its BVH with the SAH builder and writes both in the native format.
+int convert_mesh(const std::string &input, const std::string &output)
+{
+    BVHBuildOptions bvh_options;
+    bvh_options.builder = BVHBuilder::SAH;
+    auto mesh = parse_mesh(input, nullptr, one_f, Vec3::zero(), bvh_options);
+    if (!mesh)
+        return 1;
+    if (!MeshFile::save(output, *mesh))
+    {
+        spdlog::error("Could not write {}", output);
+        return 1;
+    }
+    spdlog::info("Wrote {}", output);
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     if (argc < 2)
     {
         spdlog::error("Usage: {} <config.yaml>", argv[0]);
+        spdlog::error("       {} convert <mesh.obj|mesh.ply> <mesh.rtmesh>", argv[0]);
         return 0;
     }
+    if (std::string(argv[1]) == "convert")
+    {
+        if (argc != 4)
+        {
+            spdlog::error("Usage: {} convert <mesh.obj|mesh.ply> <mesh.rtmesh>", argv[0]);
+            return 1;
+        }
+        return convert_mesh(argv[2], argv[3]);
+    }
 
     const char *config_file = argv[1];
     YAML::Node config;
@@ -105,6 +248,20 @@ int main(int argc, char **argv)
 
     unsigned int num_threads = std::thread::hardware_concurrency(); // Default to all cores
 
+    BVHBuildOptions bvh_options;
+    std::string bvh_builder = "median";
+    std::string bvh_layout = "auto";
+    bool bvh_two_level = false;
+    std::string bvh_cache; // path of the on-disk BVH cache, empty to always build
+    bool bvh_stats = false;
+    int bvh_quantize_bits = 0; // 0 keeps full-precision node bounds
+    int ray_packet_size = 0;   // 0 traces primary rays one at a time
+    std::string renderer_name = "recursive";
+    int wavefront_batch_size = 1 << 16;
+    int frames = 1;
+    std::optional<std::uint32_t> seed; // fixes the random numbers the scene is generated from
+    std::vector<MeshEntry> mesh_entries;
+
     try
     {
         fov = config["fov"].as<FloatType>();
@@ -145,6 +302,166 @@ int main(int argc, char **argv)
                 num_threads = _num_threads;
             }
         }
+
+        if (config["bvh_builder"])
+        {
+            auto builder = config["bvh_builder"].as<std::string>();
+            if (builder == "median")
+                bvh_options.builder = BVHBuilder::Median;
+            else if (builder == "sah")
+                bvh_options.builder = BVHBuilder::SAH;
+            else if (builder == "sbvh")
+                bvh_options.builder = BVHBuilder::SBVH;
+            else if (builder == "lbvh")
+                bvh_options.builder = BVHBuilder::LBVH;
+            else
+                spdlog::warn("Unknown bvh_builder '{}', using median", builder);
+            if (builder == "sah" || builder == "sbvh" || builder == "lbvh")
+                bvh_builder = builder;
+        }
+        if (config["bvh_split_budget"])
+        {
+            FloatType budget = config["bvh_split_budget"].as<FloatType>();
+            if (budget < zero_f)
+                spdlog::warn("Requested bvh_split_budget {} is negative, using {}", budget, bvh_options.sbvh_split_budget);
+            else
+                bvh_options.sbvh_split_budget = budget;
+        }
+        if (config["bvh_morton_bits"])
+        {
+            int bits = config["bvh_morton_bits"].as<int>();
+            if (bits != 30 && bits != 63)
+                spdlog::warn("Requested bvh_morton_bits {} is not 30 or 63, using {}", bits, bvh_options.morton_bits);
+            else
+                bvh_options.morton_bits = bits;
+        }
+        if (config["bvh_treelet_passes"])
+        {
+            int passes = config["bvh_treelet_passes"].as<int>();
+            if (passes < 0)
+                spdlog::warn("Requested bvh_treelet_passes {} is negative, using {}", passes, bvh_options.treelet_passes);
+            else
+                bvh_options.treelet_passes = passes;
+        }
+        if (config["bvh_sah_bins"])
+        {
+            int bins = config["bvh_sah_bins"].as<int>();
+            if (bins < 2)
+                spdlog::warn("Requested bvh_sah_bins {} is less than 2, using {}", bins, bvh_options.sah_bins);
+            else
+                bvh_options.sah_bins = bins;
+        }
+        if (config["bvh_max_leaf_size"])
+        {
+            int leaf_size = config["bvh_max_leaf_size"].as<int>();
+            if (leaf_size < 1 || leaf_size > 255)
+                spdlog::warn("Requested bvh_max_leaf_size {} is outside [1, 255], using {}", leaf_size, bvh_options.max_leaf_size);
+            else
+                bvh_options.max_leaf_size = leaf_size;
+        }
+        if (config["bvh_parallel_build"])
+            bvh_options.parallel = config["bvh_parallel_build"].as<bool>();
+        if (config["bvh_motion_bounds"])
+            bvh_options.motion_bounds = config["bvh_motion_bounds"].as<bool>();
+        if (config["bvh_refit_cost_ratio"])
+        {
+            // Below 1 a refitted tree is never good enough and every frame rebuilds.
+            FloatType ratio = config["bvh_refit_cost_ratio"].as<FloatType>();
+            if (!(ratio >= one_f))
+                spdlog::warn("Requested bvh_refit_cost_ratio {} is less than 1, using {}", ratio, bvh_options.refit_cost_ratio);
+            else
+                bvh_options.refit_cost_ratio = ratio;
+        }
+        if (config["seed"])
+            seed = config["seed"].as<std::uint32_t>();
+        if (config["frames"])
+        {
+            int _frames = config["frames"].as<int>();
+            if (_frames < 1)
+                spdlog::warn("Requested frames {} is less than 1, using {}", _frames, frames);
+            else
+                frames = _frames;
+        }
+        if (config["bvh_two_level"])
+            bvh_two_level = config["bvh_two_level"].as<bool>();
+        if (config["bvh_layout"])
+        {
+            bvh_layout = config["bvh_layout"].as<std::string>();
+            if (bvh_layout != "auto" && bvh_layout != "binary" && bvh_layout != "bvh4" && bvh_layout != "bvh8")
+            {
+                spdlog::warn("Unknown bvh_layout '{}', using auto", bvh_layout);
+                bvh_layout = "auto";
+            }
+        }
+        if (config["bvh_quantize_bits"])
+        {
+            int bits = config["bvh_quantize_bits"].as<int>();
+            if (bits != 0 && bits != 8 && bits != 16)
+                spdlog::warn("Requested bvh_quantize_bits {} is not 0, 8 or 16, using {}", bits, bvh_quantize_bits);
+            else
+                bvh_quantize_bits = bits;
+        }
+        if (config["ray_packet_size"])
+        {
+            int size = config["ray_packet_size"].as<int>();
+            if (size != 0 && size != 4 && size != 8 && size != 16)
+                spdlog::warn("Requested ray_packet_size {} is not 0, 4, 8 or 16, using {}", size, ray_packet_size);
+            else
+                ray_packet_size = size;
+        }
+        if (config["renderer"])
+        {
+            std::string name = config["renderer"].as<std::string>();
+            if (name != "recursive" && name != "wavefront")
+                spdlog::warn("Requested renderer {} is unknown, using {}", name, renderer_name);
+            else
+                renderer_name = name;
+        }
+        if (config["wavefront_batch_size"])
+        {
+            int size = config["wavefront_batch_size"].as<int>();
+            if (size <= 0)
+                spdlog::warn("Requested wavefront_batch_size {} is not positive, using {}", size, wavefront_batch_size);
+            else
+                wavefront_batch_size = size;
+        }
+        if (config["meshes"])
+        {
+            for (const auto &mesh_node : config["meshes"])
+            {
+                MeshEntry entry;
+                entry.path = mesh_node["path"].as<std::string>();
+                if (mesh_node["material"])
+                {
+                    std::string material = mesh_node["material"].as<std::string>();
+                    if (material != "lambertian" && material != "metal" && material != "dielectric" && material != "light")
+                        spdlog::warn("Requested mesh material {} is unknown, using {}", material, entry.material);
+                    else
+                        entry.material = material;
+                }
+                if (mesh_node["color"])
+                {
+                    auto color_node = mesh_node["color"];
+                    entry.color = Color(color_node[0].as<FloatType>(), color_node[1].as<FloatType>(), color_node[2].as<FloatType>());
+                }
+                if (mesh_node["fuzz"])
+                    entry.fuzz = mesh_node["fuzz"].as<FloatType>();
+                if (mesh_node["refraction_index"])
+                    entry.refraction_index = mesh_node["refraction_index"].as<FloatType>();
+                if (mesh_node["scale"])
+                    entry.scale = mesh_node["scale"].as<FloatType>();
+                if (mesh_node["translate"])
+                {
+                    auto translate_node = mesh_node["translate"];
+                    entry.translate = Vec3(translate_node[0].as<FloatType>(), translate_node[1].as<FloatType>(), translate_node[2].as<FloatType>());
+                }
+                mesh_entries.push_back(entry);
+            }
+        }
+        if (config["bvh_cache"])
+            bvh_cache = config["bvh_cache"].as<std::string>();
+        if (config["bvh_stats"])
+            bvh_stats = config["bvh_stats"].as<bool>();
     }
     catch (const YAML::RepresentationException &e)
     {
@@ -167,41 +484,237 @@ int main(int argc, char **argv)
     spdlog::info("Max depth: {}", max_depth);
 
     spdlog::info("Gamma: {}", gamma);
+    spdlog::info("BVH builder: {}", bvh_builder);
 
     constexpr int channels = 3;
 
     std::string scene_name = "random";
     if (config["scene"])
         scene_name = config["scene"].as<std::string>();
+    // A fixed seed makes scenes built from random numbers, such as random
+    // and final, the same in every run, so they can hit the BVH cache.
+    if (seed)
+        seed_random(*seed);
+    else if (!bvh_cache.empty())
+        spdlog::info("No seed given: scenes generated from random numbers differ per run and miss the BVH cache");
     auto scene = create_scene(scene_name, time0, time1);
 
+    for (const MeshEntry &entry : mesh_entries)
+    {
+        auto mesh = load_mesh(entry, *scene, bvh_options);
+        if (!mesh)
+            return 1;
+        scene->world.add(mesh);
+    }
+
     Camera camera(image_width, image_height, fov, focus_dist, defocus_angle, Mat4::identity(), time0, time1);
     camera.set_position(Vec3(camera_position[0], camera_position[1], camera_position[2]));
     camera.look_at(Vec3(camera_look_at[0], camera_look_at[1], camera_look_at[2]));
 
     std::vector<unsigned char> pixels(image_width * image_height * channels);
 
+    // Only the binary and wide BVHs trace a packet together; quantized and
+    // two-level structures would test its rays one at a time.
+    if (ray_packet_size > 0 && (bvh_quantize_bits != 0 || bvh_two_level))
+    {
+        spdlog::warn("Requested ray_packet_size {} is not supported with {}, tracing primary rays one at a time",
+                     ray_packet_size, bvh_two_level ? "bvh_two_level" : "bvh_quantize_bits");
+        ray_packet_size = 0;
+    }
+
     std::unique_ptr<Renderer> renderer;
-    renderer = std::make_unique<MyRenderer>(samples_per_pixel, max_depth, gamma);
+    if (renderer_name == "wavefront")
+    {
+        renderer = std::make_unique<WavefrontRenderer>(samples_per_pixel, max_depth, gamma, wavefront_batch_size);
+        spdlog::info("Wavefront renderer with up to {} paths in flight per thread", wavefront_batch_size);
+    }
+    else
+    {
+        renderer = std::make_unique<MyRenderer>(samples_per_pixel, max_depth, gamma, ray_packet_size);
+        if (ray_packet_size > 0)
+            spdlog::info("Tracing primary rays in packets of {}", ray_packet_size);
+    }
+
+    std::unique_ptr<BVH> bvh;
+    std::unique_ptr<TLAS> tlas;
+    std::unique_ptr<Hittable> wide_bvh;
 
-    auto start_time = std::chrono::high_resolution_clock::now();
-    renderer->render(camera, scene->world, scene->background, pixels.data());
-    auto end_time = std::chrono::high_resolution_clock::now();
+    // A single-level BVH may come from the on-disk cache, which is only used
+    // when its scene hash matches the scene generated in this run.
+    std::uint64_t scene_hash = 0;
+    if (!bvh_cache.empty() && !bvh_two_level)
+    {
+        auto load_start_time = std::chrono::high_resolution_clock::now();
+        scene_hash = BVHCache::scene_hash(scene->world.objects, time0, time1, bvh_options);
+        bvh = BVHCache::load(bvh_cache, scene_hash, scene->world.objects, bvh_options);
+        auto load_end_time = std::chrono::high_resolution_clock::now();
+        auto load_duration = std::chrono::duration_cast<std::chrono::milliseconds>(load_end_time - load_start_time);
+        if (bvh)
+            spdlog::info("BVH loaded from cache {} in {}: {} nodes", bvh_cache, format_duration(load_duration), bvh->nodes.size());
+        else
+            spdlog::info("BVH cache {} is missing or does not match the scene, rebuilding", bvh_cache);
+    }
 
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-    spdlog::info("Rendering completed in {}", format_duration(duration));
+    auto build_start_time = std::chrono::high_resolution_clock::now();
+    bool built = !bvh;
+    if (bvh_two_level)
+        tlas = std::make_unique<TLAS>(scene->world.objects, time0, time1, bvh_options);
+    else if (built)
+        bvh = std::make_unique<BVH>(scene->world.objects, time0, time1, bvh_options);
+    auto build_end_time = std::chrono::high_resolution_clock::now();
 
-    const char *filename = "output.png";
-    int stride_in_bytes = image_width * channels;
+    auto build_duration = std::chrono::duration_cast<std::chrono::milliseconds>(build_end_time - build_start_time);
+    if (built && !bvh_cache.empty() && !bvh_two_level)
+    {
+        if (BVHCache::save(bvh_cache, *bvh, scene_hash))
+            spdlog::info("BVH saved to cache {}", bvh_cache);
+        else
+            spdlog::warn("Could not write BVH cache {}", bvh_cache);
+    }
+    if (tlas)
+    {
+        spdlog::info("TLAS built in {}: {} instances over {} BLAS, {} top-level nodes", format_duration(build_duration),
+                     tlas->instances.size(), tlas->blases.size(), tlas->top.nodes.size());
+    }
+    else if (built)
+    {
+        spdlog::info("BVH built by the {} builder in {}: {} nodes, SAH cost {:.3f}", bvh_builder, format_duration(build_duration),
+                     bvh->nodes.size(), bvh->sah_cost());
+        if (bvh->primitives.size() > scene->world.objects.size())
+            spdlog::info("Spatial splits added {} primitive references", bvh->primitives.size() - scene->world.objects.size());
+        if (!bvh->motion_boxes.empty())
+            spdlog::info("BVH node bounds are interpolated over the shutter interval");
+    }
+
+    if (bvh_stats)
+        BVHStats::collect(tlas ? tlas->top : *bvh).log();
+
+    // Pick the widest node layout the CPU can test in a single instruction
+    // sequence, keeping the binary BVH as the fallback.
+    const bool explicit_layout = bvh_layout != "auto";
+    if (bvh_layout == "auto")
+    {
+        if (CpuFeatures::supports_avx512f())
+            bvh_layout = "bvh8";
+        else if (CpuFeatures::supports_avx())
+            bvh_layout = "bvh4";
+        else
+            bvh_layout = "binary";
+    }
 
-    if (stbi_write_png(filename, image_width, image_height, channels, pixels.data(), stride_in_bytes))
+    // Quantized bounds only exist for wide nodes, so a binary layout is
+    // collapsed to BVH4 when they are requested.
+    if (bvh_quantize_bits != 0 && bvh_layout == "binary" && !tlas)
     {
-        spdlog::info("Successfully saved image to {}", filename);
+        if (explicit_layout)
+            spdlog::warn("Requested bvh_layout binary has no quantized form, using bvh4 for bvh_quantize_bits {}", bvh_quantize_bits);
+        bvh_layout = "bvh4";
     }
+
+    auto make_wide_bvh = [&]() -> std::unique_ptr<Hittable>
+    {
+        if (tlas || bvh_layout == "binary")
+            return nullptr;
+        if (bvh_quantize_bits == 8)
+        {
+            if (bvh_layout == "bvh4")
+                return std::make_unique<QuantizedBVH<4, std::uint8_t>>(*bvh);
+            return std::make_unique<QuantizedBVH<8, std::uint8_t>>(*bvh);
+        }
+        if (bvh_quantize_bits == 16)
+        {
+            if (bvh_layout == "bvh4")
+                return std::make_unique<QuantizedBVH<4, std::uint16_t>>(*bvh);
+            return std::make_unique<QuantizedBVH<8, std::uint16_t>>(*bvh);
+        }
+        if (bvh_layout == "bvh4")
+            return std::make_unique<WideBVH<4>>(*bvh);
+        return std::make_unique<WideBVH<8>>(*bvh);
+    };
+
+    wide_bvh = make_wide_bvh();
+    if (tlas)
+        spdlog::info("Using two-level BVH");
+    else if (auto bvh4 = dynamic_cast<const WideBVH<4> *>(wide_bvh.get()))
+        spdlog::info("Using BVH4 with {} box tests: {} nodes, {:.2f} MiB of nodes", WideBVH<4>::kernel_name(bvh4->kernel),
+                     bvh4->nodes.size(), to_mib(bvh4->node_memory()));
+    else if (auto bvh8 = dynamic_cast<const WideBVH<8> *>(wide_bvh.get()))
+        spdlog::info("Using BVH8 with {} box tests: {} nodes, {:.2f} MiB of nodes", WideBVH<8>::kernel_name(bvh8->kernel),
+                     bvh8->nodes.size(), to_mib(bvh8->node_memory()));
+    else if (auto qbvh4 = dynamic_cast<const QuantizedBVH<4, std::uint8_t> *>(wide_bvh.get()))
+        log_quantized_bvh(*qbvh4);
+    else if (auto qbvh4 = dynamic_cast<const QuantizedBVH<4, std::uint16_t> *>(wide_bvh.get()))
+        log_quantized_bvh(*qbvh4);
+    else if (auto qbvh8 = dynamic_cast<const QuantizedBVH<8, std::uint8_t> *>(wide_bvh.get()))
+        log_quantized_bvh(*qbvh8);
+    else if (auto qbvh8 = dynamic_cast<const QuantizedBVH<8, std::uint16_t> *>(wide_bvh.get()))
+        log_quantized_bvh(*qbvh8);
     else
+        spdlog::info("Using binary BVH: {} nodes, {:.2f} MiB of nodes", bvh->nodes.size(), to_mib(bvh->node_memory()));
+
+    // Every material the scene uses is in `scene->materials`, including the
+    // mesh materials created above.
+    const MaterialTable materials(scene->materials);
+
+    int stride_in_bytes = image_width * channels;
+    FloatType shutter = time1 - time0;
+
+    // Each frame advances the shutter interval by its own length. The tree
+    // keeps its topology across frames and is only refitted to the moved
+    // primitives, unless refitting has degraded it enough to rebuild.
+    for (int frame = 0; frame < frames; ++frame)
     {
-        spdlog::error("Failed to save image to {}", filename);
-        return 1;
+        FloatType frame_time0 = time0 + frame * shutter;
+        FloatType frame_time1 = frame_time0 + shutter;
+        if (frame > 0)
+        {
+            auto update_start_time = std::chrono::high_resolution_clock::now();
+            bool rebuilt = false;
+            if (tlas)
+            {
+                rebuilt = tlas->update(frame_time0, frame_time1);
+            }
+            else if (!bvh->refit(frame_time0, frame_time1))
+            {
+                bvh = std::make_unique<BVH>(scene->world.objects, frame_time0, frame_time1, bvh_options);
+                rebuilt = true;
+            }
+            wide_bvh = make_wide_bvh();
+            auto update_end_time = std::chrono::high_resolution_clock::now();
+            auto update_duration = std::chrono::duration_cast<std::chrono::milliseconds>(update_end_time - update_start_time);
+            spdlog::info("Frame {}: BVH {} in {}", frame, rebuilt ? "rebuilt" : "refitted", format_duration(update_duration));
+        }
+        const Hittable &world = tlas ? static_cast<const Hittable &>(*tlas) : wide_bvh ? *wide_bvh : static_cast<const Hittable &>(*bvh);
+        camera.time0 = frame_time0;
+        camera.time1 = frame_time1;
+
+        auto start_time = std::chrono::high_resolution_clock::now();
+        renderer->render(camera, world, materials, scene->background, pixels.data());
+        auto end_time = std::chrono::high_resolution_clock::now();
+
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+        spdlog::info("Rendering completed in {}", format_duration(duration));
+
+        std::string filename = frames == 1 ? "output.png" : fmt::format("output_{:04d}.png", frame);
+        if (stbi_write_png(filename.c_str(), image_width, image_height, channels, pixels.data(), stride_in_bytes))
+        {
+            spdlog::info("Successfully saved image to {}", filename);
+        }
+        else
+        {
+            spdlog::error("Failed to save image to {}", filename);
+            return 1;
+        }
+    }
+
+    if constexpr (RayStats::enabled)
+    {
+        RayCounters counters = RayStats::total();
+        FloatType traversals = static_cast<FloatType>(counters.traversals > 0 ? counters.traversals : 1);
+        spdlog::info("Ray stats: {} BVH traversals, {} nodes visited, {} primitive tests, {} primitive hits",
+                     counters.traversals, counters.nodes_visited, counters.primitive_tests, counters.primitive_hits);
+        spdlog::info("Ray stats per traversal: {:.2f} nodes visited, {:.2f} primitive tests, {:.2f} primitive hits",
+                     counters.nodes_visited / traversals, counters.primitive_tests / traversals, counters.primitive_hits / traversals);
     }
 
     return 0;
@@ -0,0 +1,128 @@
+#include "bvh_cache.h"
+
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+#include "content_hash.h"
+#include "mapped_file.h"
+
+namespace BVHCache
+{
+    // Bump whenever the layout of the file or of the node arrays changes.
+    static constexpr std::uint32_t version = 1;
+    static constexpr char magic[8] = {'R', 'T', 'B', 'V', 'H', 0, 0, 0};
+
+    // The header is followed by the node, motion box and index arrays in
+    // that order. Every part is a multiple of 8 bytes up to the indices, so
+    // the arrays stay aligned in the mapping.
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t float_size;
+        std::uint32_t node_size;
+        std::uint32_t motion_box_size;
+        std::uint64_t scene_hash;
+        std::uint64_t node_count;
+        std::uint64_t motion_box_count;
+        std::uint64_t index_count;
+        FloatType time0;
+        FloatType time1;
+        FloatType build_cost;
+        FloatType pad;
+    };
+
+    static_assert(std::is_trivially_copyable_v<BVH::Node>);
+    static_assert(std::is_trivially_copyable_v<BVH::MotionBox>);
+    static_assert(sizeof(Header) % 8 == 0 && sizeof(BVH::Node) % 8 == 0 && sizeof(BVH::MotionBox) % 8 == 0);
+
+    std::uint64_t scene_hash(const std::vector<std::shared_ptr<Hittable>> &objects, FloatType time0, FloatType time1,
+                             const BVHBuildOptions &options)
+    {
+        ContentHash hash;
+        hash.add(static_cast<std::uint64_t>(objects.size()));
+        hash.add(time0);
+        hash.add(time1);
+        hash.add(static_cast<std::uint64_t>(options.builder));
+        hash.add(static_cast<std::uint64_t>(options.sah_bins));
+        hash.add(static_cast<std::uint64_t>(options.max_leaf_size));
+        hash.add(static_cast<std::uint64_t>(options.leaf_width));
+        hash.add(static_cast<std::uint64_t>(options.motion_bounds));
+        hash.add(options.sbvh_split_budget);
+        hash.add(static_cast<std::uint64_t>(options.morton_bits));
+        hash.add(static_cast<std::uint64_t>(options.treelet_passes));
+        for (const auto &object : objects)
+            object->hash_geometry(hash, time0, time1);
+        return hash.value;
+    }
+
+    bool save(const std::string &path, const BVH &bvh, std::uint64_t hash)
+    {
+        Header header{};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.float_size = sizeof(FloatType);
+        header.node_size = sizeof(BVH::Node);
+        header.motion_box_size = sizeof(BVH::MotionBox);
+        header.scene_hash = hash;
+        header.node_count = bvh.nodes.size();
+        header.motion_box_count = bvh.motion_boxes.size();
+        header.index_count = bvh.indices.size();
+        header.time0 = bvh.time0;
+        header.time1 = bvh.time1;
+        header.build_cost = bvh.build_cost;
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(bvh.nodes.data()), bvh.nodes.size() * sizeof(BVH::Node));
+        file.write(reinterpret_cast<const char *>(bvh.motion_boxes.data()), bvh.motion_boxes.size() * sizeof(BVH::MotionBox));
+        file.write(reinterpret_cast<const char *>(bvh.indices.data()), bvh.indices.size() * sizeof(std::uint32_t));
+        return static_cast<bool>(file);
+    }
+
+    std::unique_ptr<BVH> load(const std::string &path, std::uint64_t hash,
+                              const std::vector<std::shared_ptr<Hittable>> &objects, const BVHBuildOptions &options)
+    {
+        MappedFile file(path);
+        if (!file.is_open() || file.size() < sizeof(Header))
+            return nullptr;
+
+        Header header;
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version ||
+            header.float_size != sizeof(FloatType) || header.node_size != sizeof(BVH::Node) ||
+            header.motion_box_size != sizeof(BVH::MotionBox) || header.scene_hash != hash)
+            return nullptr;
+        // Guard the size computation below against absurd counts.
+        if (header.node_count > file.size() || header.motion_box_count > file.size() || header.index_count > file.size())
+            return nullptr;
+        std::uint64_t expected_size = sizeof(Header) + header.node_count * sizeof(BVH::Node) +
+                                      header.motion_box_count * sizeof(BVH::MotionBox) +
+                                      header.index_count * sizeof(std::uint32_t);
+        if (file.size() != expected_size)
+            return nullptr;
+
+        const unsigned char *cursor = file.data() + sizeof(Header);
+        const auto *nodes = reinterpret_cast<const BVH::Node *>(cursor);
+        cursor += header.node_count * sizeof(BVH::Node);
+        const auto *motion_boxes = reinterpret_cast<const BVH::MotionBox *>(cursor);
+        cursor += header.motion_box_count * sizeof(BVH::MotionBox);
+        const auto *indices = reinterpret_cast<const std::uint32_t *>(cursor);
+
+        auto bvh = std::make_unique<BVH>(std::vector<BVH::MotionBox>(), header.time0, header.time1, options);
+        bvh->nodes.assign(nodes, nodes + header.node_count);
+        bvh->motion_boxes.assign(motion_boxes, motion_boxes + header.motion_box_count);
+        bvh->indices.assign(indices, indices + header.index_count);
+        if (!bvh->is_well_formed(objects.size()))
+            return nullptr;
+        bvh->build_cost = header.build_cost;
+        bvh->primitives.reserve(bvh->indices.size());
+        for (std::uint32_t index : bvh->indices)
+            bvh->primitives.push_back(objects[index]);
+        bvh->table = std::make_shared<const PrimitiveTable>(bvh->primitives);
+        return bvh;
+    }
+}
@@ -0,0 +1,69 @@
+#include "bvh_stats.h"
+
+#include <string>
+#include <utility>
+
+#include <spdlog/spdlog.h>
+
+BVHStats BVHStats::collect(const BVH &bvh)
+{
+    BVHStats stats;
+    stats.node_count = bvh.nodes.size();
+    stats.sah_cost = bvh.sah_cost();
+    stats.memory_bytes = bvh.nodes.size() * sizeof(BVH::Node) + bvh.motion_boxes.size() * sizeof(BVH::MotionBox) +
+                         bvh.indices.size() * sizeof(std::uint32_t) + bvh.primitives.size() * sizeof(bvh.primitives[0]) +
+                         (bvh.table ? bvh.table->memory() : 0);
+    if (bvh.nodes.empty())
+        return stats;
+
+    FloatType overlap_sum = zero_f;
+    size_t interior_count = 0;
+    std::vector<std::pair<std::uint32_t, size_t>> stack = {{0, 0}};
+    while (!stack.empty())
+    {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        const BVH::Node &node = bvh.nodes[index];
+        if (node.is_leaf())
+        {
+            ++stats.leaf_count;
+            stats.reference_count += node.count;
+            if (stats.leaves_per_depth.size() <= depth)
+                stats.leaves_per_depth.resize(depth + 1, 0);
+            ++stats.leaves_per_depth[depth];
+            continue;
+        }
+
+        FloatType area = node.box.surface_area();
+        AABB overlap = AABB::intersection(bvh.nodes[index + 1].box, bvh.nodes[node.offset].box);
+        if (area > zero_f && !overlap.is_empty())
+            overlap_sum += overlap.surface_area() / area;
+        ++interior_count;
+        stack.push_back({index + 1, depth + 1});
+        stack.push_back({node.offset, depth + 1});
+    }
+
+    stats.average_leaf_size = static_cast<FloatType>(stats.reference_count) / static_cast<FloatType>(stats.leaf_count);
+    if (interior_count > 0)
+        stats.overlap_ratio = overlap_sum / static_cast<FloatType>(interior_count);
+    return stats;
+}
+
+void BVHStats::log() const
+{
+    spdlog::info("BVH stats: {} nodes, {} leaves, {} references, max depth {}", node_count, leaf_count, reference_count,
+                 leaves_per_depth.empty() ? 0 : leaves_per_depth.size() - 1);
+    spdlog::info("BVH stats: SAH cost {:.3f}, average leaf size {:.2f}, sibling overlap {:.3f}, {:.2f} MiB",
+                 sah_cost, average_leaf_size, overlap_ratio, memory_bytes / (1024.0 * 1024.0));
+
+    std::string histogram;
+    for (size_t depth = 0; depth < leaves_per_depth.size(); ++depth)
+    {
+        if (leaves_per_depth[depth] == 0)
+            continue;
+        if (!histogram.empty())
+            histogram += ", ";
+        histogram += std::to_string(depth) + ": " + std::to_string(leaves_per_depth[depth]);
+    }
+    spdlog::info("BVH stats: leaves per depth {{{}}}", histogram);
+}
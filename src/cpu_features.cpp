@@ -0,0 +1,52 @@
+#include "cpu_features.h"
+
+#if defined(RT_X86_64) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace CpuFeatures
+{
+#if defined(RT_X86_64) && defined(_MSC_VER)
+    static bool os_saves_ymm(unsigned long long mask)
+    {
+        int info[4];
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        return osxsave && (_xgetbv(0) & mask) == mask;
+    }
+
+    bool supports_avx()
+    {
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 28)) != 0 && os_saves_ymm(0x6);
+    }
+
+    bool supports_avx512f()
+    {
+        int info[4];
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 16)) != 0 && os_saves_ymm(0xE6);
+    }
+#elif defined(RT_X86_64)
+    bool supports_avx()
+    {
+        return __builtin_cpu_supports("avx");
+    }
+
+    bool supports_avx512f()
+    {
+        return __builtin_cpu_supports("avx512f");
+    }
+#else
+    bool supports_avx()
+    {
+        return false;
+    }
+
+    bool supports_avx512f()
+    {
+        return false;
+    }
+#endif
+}
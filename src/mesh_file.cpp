@@ -0,0 +1,165 @@
+#include "mesh_file.h"
+
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+#include <spdlog/spdlog.h>
+
+#include "mapped_file.h"
+
+namespace MeshFile
+{
+    // Bump whenever the header or the layout of an array changes.
+    static constexpr std::uint32_t version = 1;
+    static constexpr char magic[8] = {'R', 'T', 'M', 'E', 'S', 'H', 0, 0};
+    static constexpr std::uint32_t byte_order_mark = 0x01020304;
+    static constexpr std::uint64_t alignment = 64;
+
+    enum Blob
+    {
+        Positions,
+        Indices,
+        Normals,
+        UVs,
+        Nodes,
+        NodeIndices,
+        BlobCount,
+    };
+
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint32_t float_size;
+        std::uint32_t node_size;
+        std::uint64_t counts[BlobCount];  // elements per array
+        std::uint64_t offsets[BlobCount]; // from the start of the file
+    };
+
+    static constexpr std::uint64_t element_sizes[BlobCount] = {
+        sizeof(Point3), sizeof(std::uint32_t), sizeof(Vec3), sizeof(TriangleMesh::UV), sizeof(BVH::Node), sizeof(std::uint32_t)};
+
+    static_assert(std::is_trivially_copyable_v<Point3> && sizeof(Point3) == 3 * sizeof(FloatType));
+    static_assert(std::is_trivially_copyable_v<TriangleMesh::UV>);
+    static_assert(std::is_trivially_copyable_v<BVH::Node>);
+
+    static std::uint64_t align_up(std::uint64_t offset) { return (offset + alignment - 1) / alignment * alignment; }
+
+    bool save(const std::string &path, const TriangleMesh &mesh)
+    {
+        const void *blobs[BlobCount] = {mesh.positions.data(), mesh.indices.data(), mesh.normals.data(),
+                                        mesh.uvs.data(), mesh.bvh.nodes.data(), mesh.bvh.indices.data()};
+        Header header{};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.byte_order = byte_order_mark;
+        header.float_size = sizeof(FloatType);
+        header.node_size = sizeof(BVH::Node);
+        header.counts[Positions] = mesh.positions.size();
+        header.counts[Indices] = mesh.indices.size();
+        header.counts[Normals] = mesh.normals.size();
+        header.counts[UVs] = mesh.uvs.size();
+        header.counts[Nodes] = mesh.bvh.nodes.size();
+        header.counts[NodeIndices] = mesh.bvh.indices.size();
+        std::uint64_t offset = align_up(sizeof(Header));
+        for (int blob = 0; blob < BlobCount; ++blob)
+        {
+            header.offsets[blob] = offset;
+            offset = align_up(offset + header.counts[blob] * element_sizes[blob]);
+        }
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+        const char padding[alignment] = {};
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        std::uint64_t written = sizeof(header);
+        for (int blob = 0; blob < BlobCount; ++blob)
+        {
+            file.write(padding, static_cast<std::streamsize>(header.offsets[blob] - written));
+            file.write(static_cast<const char *>(blobs[blob]), static_cast<std::streamsize>(header.counts[blob] * element_sizes[blob]));
+            written = header.offsets[blob] + header.counts[blob] * element_sizes[blob];
+        }
+        return static_cast<bool>(file);
+    }
+
+    std::shared_ptr<TriangleMesh> load(const std::string &path, const Material *material)
+    {
+        auto file = std::make_shared<MappedFile>(path);
+        if (!file->is_open())
+        {
+            spdlog::error("{}: cannot open mesh file", path);
+            return nullptr;
+        }
+
+        Header header;
+        if (file->size() < sizeof(Header))
+        {
+            spdlog::error("{}: not an .rtmesh file", path);
+            return nullptr;
+        }
+        std::memcpy(&header, file->data(), sizeof(header));
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0)
+        {
+            spdlog::error("{}: not an .rtmesh file", path);
+            return nullptr;
+        }
+        if (header.version != version || header.byte_order != byte_order_mark || header.float_size != sizeof(FloatType) ||
+            header.node_size != sizeof(BVH::Node))
+        {
+            spdlog::error("{}: written by an incompatible build, convert the source mesh again", path);
+            return nullptr;
+        }
+
+        for (int blob = 0; blob < BlobCount; ++blob)
+        {
+            // Counts are checked first so the sizes below cannot overflow.
+            if (header.counts[blob] > file->size() || header.offsets[blob] % alignment != 0 ||
+                header.offsets[blob] > file->size() ||
+                header.counts[blob] * element_sizes[blob] > file->size() - header.offsets[blob])
+            {
+                spdlog::error("{}: mesh data is truncated", path);
+                return nullptr;
+            }
+        }
+        const std::uint64_t vertex_count = header.counts[Positions];
+        if (header.counts[Indices] % 3 != 0 || (header.counts[Normals] != 0 && header.counts[Normals] != vertex_count) ||
+            (header.counts[UVs] != 0 && header.counts[UVs] != vertex_count))
+        {
+            spdlog::error("{}: mesh arrays have inconsistent sizes", path);
+            return nullptr;
+        }
+
+        auto blob = [&](Blob which) { return file->data() + header.offsets[which]; };
+        std::span<const std::uint32_t> indices(reinterpret_cast<const std::uint32_t *>(blob(Indices)), header.counts[Indices]);
+        for (std::uint32_t index : indices)
+        {
+            if (index >= vertex_count)
+            {
+                spdlog::error("{}: face references an undefined vertex", path);
+                return nullptr;
+            }
+        }
+
+        BVH bvh(std::vector<BVH::MotionBox>(), zero_f, zero_f);
+        const auto *nodes = reinterpret_cast<const BVH::Node *>(blob(Nodes));
+        const auto *node_indices = reinterpret_cast<const std::uint32_t *>(blob(NodeIndices));
+        bvh.nodes.assign(nodes, nodes + header.counts[Nodes]);
+        bvh.indices.assign(node_indices, node_indices + header.counts[NodeIndices]);
+        if (!bvh.is_well_formed(header.counts[Indices] / 3))
+        {
+            spdlog::error("{}: mesh BVH is malformed", path);
+            return nullptr;
+        }
+
+        return std::make_shared<TriangleMesh>(
+            file,
+            std::span<const Point3>(reinterpret_cast<const Point3 *>(blob(Positions)), vertex_count),
+            indices,
+            std::span<const Vec3>(reinterpret_cast<const Vec3 *>(blob(Normals)), header.counts[Normals]),
+            std::span<const TriangleMesh::UV>(reinterpret_cast<const TriangleMesh::UV *>(blob(UVs)), header.counts[UVs]),
+            material, std::move(bvh));
+    }
+}
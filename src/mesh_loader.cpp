@@ -0,0 +1,853 @@
+#include "mesh_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <sstream>
+
+#include <spdlog/spdlog.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include "mapped_file.h"
+
+namespace MeshLoader
+{
+    // OBJ text is split at line breaks into chunks of about this size, which
+    // are counted and then parsed independently.
+    static constexpr std::size_t obj_chunk_size = std::size_t(1) << 22;
+
+    struct ObjCounts
+    {
+        std::size_t positions = 0;
+        std::size_t uvs = 0;
+        std::size_t normals = 0;
+        std::size_t triangles = 0;
+    };
+
+    struct ObjChunk
+    {
+        const char *begin;
+        const char *end;
+        ObjCounts counts{};  // elements defined in this chunk
+        ObjCounts offsets{}; // elements defined before this chunk
+        bool uvs_match = true;     // every face corner names a texture coordinate equal to its position index
+        bool normals_match = true; // likewise for normals
+        const char *error_line = nullptr;
+        const char *error = nullptr;
+    };
+
+    enum class ObjLine
+    {
+        Position,
+        UV,
+        Normal,
+        Face,
+        Other,
+    };
+
+    static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    static const char *skip_spaces(const char *p, const char *end)
+    {
+        while (p < end && is_space(*p))
+            ++p;
+        return p;
+    }
+
+    static const char *find_line_end(const char *p, const char *end)
+    {
+        const void *newline = std::memchr(p, '\n', static_cast<std::size_t>(end - p));
+        return newline ? static_cast<const char *>(newline) : end;
+    }
+
+    // Identifies the statement of a line and moves `p` past its keyword.
+    static ObjLine classify(const char *&p, const char *end)
+    {
+        p = skip_spaces(p, end);
+        auto keyword = [&](const char *word, std::size_t length)
+        {
+            if (static_cast<std::size_t>(end - p) < length || std::memcmp(p, word, length) != 0)
+                return false;
+            if (p + length < end && !is_space(p[length]))
+                return false;
+            p += length;
+            return true;
+        };
+        if (keyword("v", 1))
+            return ObjLine::Position;
+        if (keyword("vt", 2))
+            return ObjLine::UV;
+        if (keyword("vn", 2))
+            return ObjLine::Normal;
+        if (keyword("f", 1))
+            return ObjLine::Face;
+        return ObjLine::Other;
+    }
+
+    template <typename T>
+    static bool parse_number(const char *&p, const char *end, T &value)
+    {
+        p = skip_spaces(p, end);
+        if (p < end && *p == '+')
+            ++p;
+        auto [next, ec] = std::from_chars(p, end, value);
+        if (ec != std::errc())
+            return false;
+        p = next;
+        return true;
+    }
+
+    // OBJ indices are 1-based, or relative to the elements defined so far
+    // when negative.
+    static bool resolve_index(long long index, std::size_t defined, std::size_t total, std::uint32_t &resolved)
+    {
+        long long position = index > 0 ? index - 1 : static_cast<long long>(defined) + index;
+        if (index == 0 || position < 0 || static_cast<std::size_t>(position) >= total)
+            return false;
+        resolved = static_cast<std::uint32_t>(position);
+        return true;
+    }
+
+    static std::size_t count_tokens(const char *p, const char *end)
+    {
+        std::size_t tokens = 0;
+        while (true)
+        {
+            p = skip_spaces(p, end);
+            if (p >= end || *p == '#')
+                return tokens;
+            ++tokens;
+            while (p < end && !is_space(*p))
+                ++p;
+        }
+    }
+
+    static void count_obj_chunk(ObjChunk &chunk)
+    {
+        for (const char *line = chunk.begin; line < chunk.end;)
+        {
+            const char *end = find_line_end(line, chunk.end);
+            const char *p = line;
+            switch (classify(p, end))
+            {
+            case ObjLine::Position:
+                ++chunk.counts.positions;
+                break;
+            case ObjLine::UV:
+                ++chunk.counts.uvs;
+                break;
+            case ObjLine::Normal:
+                ++chunk.counts.normals;
+                break;
+            case ObjLine::Face:
+                chunk.counts.triangles += std::max<std::size_t>(count_tokens(p, end), 2) - 2;
+                break;
+            case ObjLine::Other:
+                break;
+            }
+            line = end + 1;
+        }
+    }
+
+    static void parse_obj_chunk(ObjChunk &chunk, const ObjCounts &totals, MeshData &mesh)
+    {
+        ObjCounts cursor = chunk.offsets;
+        auto fail = [&](const char *line, const char *error)
+        {
+            chunk.error_line = line;
+            chunk.error = error;
+        };
+
+        for (const char *line = chunk.begin; line < chunk.end; )
+        {
+            const char *end = find_line_end(line, chunk.end);
+            const char *p = line;
+            switch (classify(p, end))
+            {
+            case ObjLine::Position:
+            {
+                Point3 &position = mesh.positions[cursor.positions++];
+                if (!parse_number(p, end, position.x) || !parse_number(p, end, position.y) || !parse_number(p, end, position.z))
+                    return fail(line, "malformed vertex position");
+                break;
+            }
+            case ObjLine::UV:
+            {
+                TriangleMesh::UV &uv = mesh.uvs[cursor.uvs++];
+                uv.v = zero_f;
+                if (!parse_number(p, end, uv.u))
+                    return fail(line, "malformed texture coordinate");
+                parse_number(p, end, uv.v);
+                break;
+            }
+            case ObjLine::Normal:
+            {
+                Vec3 &normal = mesh.normals[cursor.normals++];
+                if (!parse_number(p, end, normal.x) || !parse_number(p, end, normal.y) || !parse_number(p, end, normal.z))
+                    return fail(line, "malformed vertex normal");
+                break;
+            }
+            case ObjLine::Face:
+            {
+                // Corners are `v`, `v/vt`, `v//vn` or `v/vt/vn`; the polygon
+                // is split into a fan around its first corner.
+                std::uint32_t first = 0;
+                std::uint32_t previous = 0;
+                int corners = 0;
+                while (true)
+                {
+                    p = skip_spaces(p, end);
+                    if (p >= end || *p == '#')
+                        break;
+                    long long v = 0;
+                    std::uint32_t vertex = 0;
+                    if (!parse_number(p, end, v) || !resolve_index(v, cursor.positions, totals.positions, vertex))
+                        return fail(line, "face references an undefined vertex");
+
+                    bool has_uv = false;
+                    bool has_normal = false;
+                    std::uint32_t uv = 0;
+                    std::uint32_t normal = 0;
+                    if (p < end && *p == '/')
+                    {
+                        ++p;
+                        if (p < end && *p != '/')
+                        {
+                            long long vt = 0;
+                            if (!parse_number(p, end, vt) || !resolve_index(vt, cursor.uvs, totals.uvs, uv))
+                                return fail(line, "face references an undefined texture coordinate");
+                            has_uv = true;
+                        }
+                        if (p < end && *p == '/')
+                        {
+                            ++p;
+                            long long vn = 0;
+                            if (!parse_number(p, end, vn) || !resolve_index(vn, cursor.normals, totals.normals, normal))
+                                return fail(line, "face references an undefined normal");
+                            has_normal = true;
+                        }
+                    }
+                    if (p < end && !is_space(*p))
+                        return fail(line, "malformed face corner");
+                    chunk.uvs_match = chunk.uvs_match && has_uv && uv == vertex;
+                    chunk.normals_match = chunk.normals_match && has_normal && normal == vertex;
+
+                    if (corners == 0)
+                        first = vertex;
+                    else if (corners >= 2)
+                    {
+                        std::uint32_t *triangle = &mesh.indices[3 * cursor.triangles++];
+                        triangle[0] = first;
+                        triangle[1] = previous;
+                        triangle[2] = vertex;
+                    }
+                    previous = vertex;
+                    ++corners;
+                }
+                if (corners < 3)
+                    return fail(line, "face has fewer than three vertices");
+                break;
+            }
+            case ObjLine::Other:
+                break;
+            }
+            line = end + 1;
+        }
+    }
+
+    static std::unique_ptr<MeshData> load_obj(const std::string &path, const char *text, std::size_t size)
+    {
+        const char *text_end = text + size;
+        std::vector<ObjChunk> chunks;
+        for (const char *begin = text; begin < text_end;)
+        {
+            const char *end = begin + std::min(obj_chunk_size, static_cast<std::size_t>(text_end - begin));
+            if (end < text_end)
+                end = std::min(find_line_end(end, text_end) + 1, text_end);
+            chunks.push_back(ObjChunk{begin, end});
+            begin = end;
+        }
+
+        tbb::parallel_for(tbb::blocked_range<std::size_t>(0, chunks.size(), 1), [&](const tbb::blocked_range<std::size_t> &range)
+        {
+            for (std::size_t i = range.begin(); i != range.end(); ++i)
+                count_obj_chunk(chunks[i]);
+        });
+
+        ObjCounts totals;
+        for (ObjChunk &chunk : chunks)
+        {
+            chunk.offsets = totals;
+            totals.positions += chunk.counts.positions;
+            totals.uvs += chunk.counts.uvs;
+            totals.normals += chunk.counts.normals;
+            totals.triangles += chunk.counts.triangles;
+        }
+        if (totals.positions > UINT32_MAX)
+        {
+            spdlog::error("{}: {} vertices exceed the 32-bit index range", path, totals.positions);
+            return nullptr;
+        }
+
+        auto mesh = std::make_unique<MeshData>();
+        mesh->file_size = size;
+        mesh->positions.resize(totals.positions, Point3::uninitialized());
+        mesh->uvs.resize(totals.uvs);
+        mesh->normals.resize(totals.normals, Vec3::uninitialized());
+        mesh->indices.resize(3 * totals.triangles);
+
+        tbb::parallel_for(tbb::blocked_range<std::size_t>(0, chunks.size(), 1), [&](const tbb::blocked_range<std::size_t> &range)
+        {
+            for (std::size_t i = range.begin(); i != range.end(); ++i)
+                parse_obj_chunk(chunks[i], totals, *mesh);
+        });
+
+        bool uvs_match = true;
+        bool normals_match = true;
+        for (const ObjChunk &chunk : chunks)
+        {
+            if (chunk.error)
+            {
+                std::size_t line = 1 + std::count(text, chunk.error_line, '\n');
+                spdlog::error("{}:{}: {}", path, line, chunk.error);
+                return nullptr;
+            }
+            uvs_match = uvs_match && chunk.uvs_match;
+            normals_match = normals_match && chunk.normals_match;
+        }
+
+        if (!mesh->uvs.empty() && !(uvs_match && mesh->uvs.size() == mesh->positions.size()))
+        {
+            spdlog::warn("{}: texture coordinates are not indexed like the positions, dropping them", path);
+            std::vector<TriangleMesh::UV>().swap(mesh->uvs);
+        }
+        if (!mesh->normals.empty() && !(normals_match && mesh->normals.size() == mesh->positions.size()))
+        {
+            spdlog::warn("{}: normals are not indexed like the positions, dropping them", path);
+            std::vector<Vec3>().swap(mesh->normals);
+        }
+        return mesh;
+    }
+
+    enum class PlyType
+    {
+        Int8,
+        UInt8,
+        Int16,
+        UInt16,
+        Int32,
+        UInt32,
+        Float32,
+        Float64,
+    };
+
+    struct PlyProperty
+    {
+        std::string name;
+        PlyType type;       // of the value, or of the items of a list
+        bool is_list;
+        PlyType count_type; // of the item count of a list
+    };
+
+    struct PlyElement
+    {
+        std::string name;
+        std::size_t count = 0;
+        std::vector<PlyProperty> properties;
+    };
+
+    static bool parse_ply_type(const std::string &name, PlyType &type)
+    {
+        if (name == "char" || name == "int8")
+            type = PlyType::Int8;
+        else if (name == "uchar" || name == "uint8")
+            type = PlyType::UInt8;
+        else if (name == "short" || name == "int16")
+            type = PlyType::Int16;
+        else if (name == "ushort" || name == "uint16")
+            type = PlyType::UInt16;
+        else if (name == "int" || name == "int32")
+            type = PlyType::Int32;
+        else if (name == "uint" || name == "uint32")
+            type = PlyType::UInt32;
+        else if (name == "float" || name == "float32")
+            type = PlyType::Float32;
+        else if (name == "double" || name == "float64")
+            type = PlyType::Float64;
+        else
+            return false;
+        return true;
+    }
+
+    static std::size_t ply_type_size(PlyType type)
+    {
+        switch (type)
+        {
+        case PlyType::Int8:
+        case PlyType::UInt8:
+            return 1;
+        case PlyType::Int16:
+        case PlyType::UInt16:
+            return 2;
+        case PlyType::Int32:
+        case PlyType::UInt32:
+        case PlyType::Float32:
+            return 4;
+        case PlyType::Float64:
+            return 8;
+        }
+        return 0;
+    }
+
+    template <typename Stored>
+    static Stored read_raw(const unsigned char *p, bool swap)
+    {
+        unsigned char bytes[sizeof(Stored)];
+        std::memcpy(bytes, p, sizeof(Stored));
+        if (swap)
+            std::reverse(bytes, bytes + sizeof(Stored));
+        Stored value;
+        std::memcpy(&value, bytes, sizeof(Stored));
+        return value;
+    }
+
+    template <typename T>
+    static T read_ply_value(const unsigned char *p, PlyType type, bool swap)
+    {
+        switch (type)
+        {
+        case PlyType::Int8:
+            return static_cast<T>(read_raw<std::int8_t>(p, swap));
+        case PlyType::UInt8:
+            return static_cast<T>(read_raw<std::uint8_t>(p, swap));
+        case PlyType::Int16:
+            return static_cast<T>(read_raw<std::int16_t>(p, swap));
+        case PlyType::UInt16:
+            return static_cast<T>(read_raw<std::uint16_t>(p, swap));
+        case PlyType::Int32:
+            return static_cast<T>(read_raw<std::int32_t>(p, swap));
+        case PlyType::UInt32:
+            return static_cast<T>(read_raw<std::uint32_t>(p, swap));
+        case PlyType::Float32:
+            return static_cast<T>(read_raw<float>(p, swap));
+        case PlyType::Float64:
+            return static_cast<T>(read_raw<double>(p, swap));
+        }
+        return T();
+    }
+
+    // Walks the records of an element of any layout; returns the end of its
+    // data, or null if it runs past `end`.
+    static const unsigned char *skip_ply_element(const PlyElement &element, const unsigned char *p, const unsigned char *end, bool swap)
+    {
+        for (std::size_t i = 0; i < element.count; ++i)
+        {
+            for (const PlyProperty &property : element.properties)
+            {
+                if (property.is_list)
+                {
+                    std::size_t count_size = ply_type_size(property.count_type);
+                    if (static_cast<std::size_t>(end - p) < count_size)
+                        return nullptr;
+                    long long items = read_ply_value<long long>(p, property.count_type, swap);
+                    p += count_size;
+                    if (items < 0 || static_cast<std::size_t>(end - p) / ply_type_size(property.type) < static_cast<std::size_t>(items))
+                        return nullptr;
+                    p += items * ply_type_size(property.type);
+                }
+                else
+                {
+                    if (static_cast<std::size_t>(end - p) < ply_type_size(property.type))
+                        return nullptr;
+                    p += ply_type_size(property.type);
+                }
+            }
+        }
+        return p;
+    }
+
+    static const PlyProperty *find_property(const PlyElement &element, std::initializer_list<const char *> names, std::size_t &offset)
+    {
+        for (const char *name : names)
+        {
+            offset = 0;
+            for (const PlyProperty &property : element.properties)
+            {
+                if (property.name == name)
+                    return &property;
+                offset += ply_type_size(property.type);
+            }
+        }
+        return nullptr;
+    }
+
+    static void read_ply_vertices(const PlyElement &element, const unsigned char *data, bool swap, MeshData &mesh)
+    {
+        std::size_t stride = 0;
+        for (const PlyProperty &property : element.properties)
+            stride += ply_type_size(property.type);
+
+        std::size_t offsets[7];
+        const PlyProperty *position[3] = {find_property(element, {"x"}, offsets[0]), find_property(element, {"y"}, offsets[1]),
+                                          find_property(element, {"z"}, offsets[2])};
+        const PlyProperty *normal[3] = {find_property(element, {"nx"}, offsets[3]), find_property(element, {"ny"}, offsets[4]),
+                                        find_property(element, {"nz"}, offsets[5])};
+        std::size_t v_offset = 0;
+        const PlyProperty *u = find_property(element, {"u", "s", "texture_u", "texture_s"}, offsets[6]);
+        const PlyProperty *v = find_property(element, {"v", "t", "texture_v", "texture_t"}, v_offset);
+
+        const bool has_normals = normal[0] && normal[1] && normal[2];
+        const bool has_uvs = u && v;
+        mesh.positions.resize(element.count, Point3::uninitialized());
+        if (has_normals)
+            mesh.normals.resize(element.count, Vec3::uninitialized());
+        if (has_uvs)
+            mesh.uvs.resize(element.count);
+
+        tbb::parallel_for(tbb::blocked_range<std::size_t>(0, element.count), [&](const tbb::blocked_range<std::size_t> &range)
+        {
+            for (std::size_t i = range.begin(); i != range.end(); ++i)
+            {
+                const unsigned char *record = data + i * stride;
+                for (int a = 0; a < 3; ++a)
+                    mesh.positions[i][a] = read_ply_value<FloatType>(record + offsets[a], position[a]->type, swap);
+                if (has_normals)
+                {
+                    for (int a = 0; a < 3; ++a)
+                        mesh.normals[i][a] = read_ply_value<FloatType>(record + offsets[3 + a], normal[a]->type, swap);
+                }
+                if (has_uvs)
+                {
+                    mesh.uvs[i].u = read_ply_value<FloatType>(record + offsets[6], u->type, swap);
+                    mesh.uvs[i].v = read_ply_value<FloatType>(record + v_offset, v->type, swap);
+                }
+            }
+        });
+    }
+
+    // Reads the vertex index lists of the face element. All-triangle files,
+    // the common case, have fixed-size records and are read in parallel;
+    // anything else is triangulated in two sequential passes.
+    static bool read_ply_faces(const std::string &path, const PlyElement &element, const unsigned char *data, const unsigned char *end,
+                               bool swap, MeshData &mesh)
+    {
+        std::size_t list_index = element.properties.size();
+        for (std::size_t i = 0; i < element.properties.size() && list_index == element.properties.size(); ++i)
+        {
+            const PlyProperty &property = element.properties[i];
+            if (property.is_list && (property.name == "vertex_indices" || property.name == "vertex_index"))
+                list_index = i;
+        }
+        if (list_index == element.properties.size())
+        {
+            spdlog::error("{}: face element has no vertex_indices list", path);
+            return false;
+        }
+
+        // Bytes of the scalar properties around the index list; other lists
+        // make the record size vary.
+        bool fixed_layout = true;
+        std::size_t before = 0;
+        std::size_t after = 0;
+        for (std::size_t i = 0; i < element.properties.size(); ++i)
+        {
+            const PlyProperty &property = element.properties[i];
+            if (i == list_index)
+                continue;
+            if (property.is_list)
+                fixed_layout = false;
+            else
+                (i < list_index ? before : after) += ply_type_size(property.type);
+        }
+
+        const PlyProperty &list = element.properties[list_index];
+        const std::size_t count_size = ply_type_size(list.count_type);
+        const std::size_t index_size = ply_type_size(list.type);
+        const std::size_t vertex_count = mesh.positions.size();
+        const std::size_t available = static_cast<std::size_t>(end - data);
+
+        if (fixed_layout && element.count > 0)
+        {
+            const std::size_t stride = before + count_size + 3 * index_size + after;
+            if (available / stride >= element.count && read_ply_value<long long>(data + before, list.count_type, swap) == 3)
+            {
+                mesh.indices.resize(3 * element.count);
+                std::atomic<bool> triangles_only{true};
+                std::atomic<bool> in_range{true};
+                tbb::parallel_for(tbb::blocked_range<std::size_t>(0, element.count), [&](const tbb::blocked_range<std::size_t> &range)
+                {
+                    for (std::size_t i = range.begin(); i != range.end(); ++i)
+                    {
+                        // Past the first non-triangle the records are not at
+                        // `stride` any more, so every range stops.
+                        if (!triangles_only.load(std::memory_order_relaxed))
+                            return;
+                        const unsigned char *record = data + i * stride + before;
+                        if (read_ply_value<long long>(record, list.count_type, swap) != 3)
+                        {
+                            triangles_only = false;
+                            return;
+                        }
+                        for (int k = 0; k < 3; ++k)
+                        {
+                            long long index = read_ply_value<long long>(record + count_size + k * index_size, list.type, swap);
+                            if (index < 0 || static_cast<std::size_t>(index) >= vertex_count)
+                                in_range = false;
+                            mesh.indices[3 * i + k] = static_cast<std::uint32_t>(index);
+                        }
+                    }
+                });
+                // Indices decoded at the wrong stride after a non-triangle are
+                // meaningless, so the range check only counts for all-triangle
+                // files.
+                if (!triangles_only)
+                {
+                    mesh.indices.clear();
+                }
+                else if (!in_range)
+                {
+                    spdlog::error("{}: face references an undefined vertex", path);
+                    return false;
+                }
+                else
+                {
+                    return true;
+                }
+            }
+        }
+
+        // Count the fan triangles first, then fill them in.
+        std::size_t triangle_count = 0;
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            const unsigned char *p = data;
+            std::size_t cursor = 0;
+            for (std::size_t i = 0; i < element.count; ++i)
+            {
+                for (std::size_t j = 0; j < element.properties.size(); ++j)
+                {
+                    const PlyProperty &property = element.properties[j];
+                    const std::size_t value_size = ply_type_size(property.type);
+                    long long items = 1;
+                    if (property.is_list)
+                    {
+                        if (static_cast<std::size_t>(end - p) < ply_type_size(property.count_type))
+                        {
+                            spdlog::error("{}: face data is truncated", path);
+                            return false;
+                        }
+                        items = read_ply_value<long long>(p, property.count_type, swap);
+                        p += ply_type_size(property.count_type);
+                    }
+                    if (items < 0 || static_cast<std::size_t>(end - p) / value_size < static_cast<std::size_t>(items))
+                    {
+                        spdlog::error("{}: face data is truncated", path);
+                        return false;
+                    }
+
+                    if (j == list_index && items < 3)
+                    {
+                        spdlog::error("{}: face {} has fewer than three vertices", path, i);
+                        return false;
+                    }
+                    if (j == list_index && pass == 0)
+                        triangle_count += items - 2;
+                    else if (j == list_index)
+                    {
+                        std::uint32_t first = 0;
+                        std::uint32_t previous = 0;
+                        for (long long k = 0; k < items; ++k)
+                        {
+                            long long index = read_ply_value<long long>(p + k * value_size, property.type, swap);
+                            if (index < 0 || static_cast<std::size_t>(index) >= vertex_count)
+                            {
+                                spdlog::error("{}: face {} references an undefined vertex", path, i);
+                                return false;
+                            }
+                            std::uint32_t vertex = static_cast<std::uint32_t>(index);
+                            if (k == 0)
+                                first = vertex;
+                            else if (k >= 2)
+                            {
+                                mesh.indices[cursor++] = first;
+                                mesh.indices[cursor++] = previous;
+                                mesh.indices[cursor++] = vertex;
+                            }
+                            previous = vertex;
+                        }
+                    }
+                    p += items * value_size;
+                }
+            }
+            if (pass == 0)
+                mesh.indices.resize(3 * triangle_count);
+        }
+        return true;
+    }
+
+    static std::unique_ptr<MeshData> load_ply(const std::string &path, const unsigned char *data, std::size_t size)
+    {
+        const char *text = reinterpret_cast<const char *>(data);
+        const char *header_end = nullptr;
+        for (const char *line = text; line < text + size;)
+        {
+            const char *end = find_line_end(line, text + size);
+            if (end - line >= 10 && std::memcmp(line, "end_header", 10) == 0)
+            {
+                header_end = end + 1;
+                break;
+            }
+            line = end + 1;
+        }
+        if (size < 4 || std::memcmp(text, "ply", 3) != 0 || !header_end || header_end > text + size)
+        {
+            spdlog::error("{}: not a PLY file", path);
+            return nullptr;
+        }
+
+        std::istringstream header(std::string(text, header_end));
+        std::vector<PlyElement> elements;
+        bool swap = false;
+        std::string line;
+        std::getline(header, line);
+        while (std::getline(header, line))
+        {
+            std::istringstream words(line);
+            std::string keyword;
+            words >> keyword;
+            if (keyword == "format")
+            {
+                std::string format;
+                words >> format;
+                if (format == "binary_little_endian")
+                    swap = std::endian::native != std::endian::little;
+                else if (format == "binary_big_endian")
+                    swap = std::endian::native != std::endian::big;
+                else
+                {
+                    spdlog::error("{}: PLY format {} is not supported, only binary", path, format);
+                    return nullptr;
+                }
+            }
+            else if (keyword == "element")
+            {
+                PlyElement element;
+                if (!(words >> element.name >> element.count))
+                {
+                    spdlog::error("{}: malformed PLY element in '{}'", path, line);
+                    return nullptr;
+                }
+                elements.push_back(element);
+            }
+            else if (keyword == "property" && !elements.empty())
+            {
+                PlyProperty property{};
+                std::string type;
+                words >> type;
+                if (type == "list")
+                {
+                    std::string count_type;
+                    words >> count_type >> type;
+                    property.is_list = true;
+                    if (!parse_ply_type(count_type, property.count_type))
+                        type.clear();
+                }
+                words >> property.name;
+                if (!parse_ply_type(type, property.type))
+                {
+                    spdlog::error("{}: unknown PLY property type in '{}'", path, line);
+                    return nullptr;
+                }
+                elements.back().properties.push_back(property);
+            }
+        }
+
+        auto mesh = std::make_unique<MeshData>();
+        mesh->file_size = size;
+        const unsigned char *end = data + size;
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(header_end);
+        const PlyElement *faces = nullptr;
+        const unsigned char *face_data = nullptr;
+        bool has_vertices = false;
+        for (const PlyElement &element : elements)
+        {
+            if (element.name == "vertex")
+            {
+                std::size_t stride = 0;
+                std::size_t position_offset = 0;
+                for (const PlyProperty &property : element.properties)
+                {
+                    if (property.is_list)
+                    {
+                        spdlog::error("{}: vertex element has a list property", path);
+                        return nullptr;
+                    }
+                    stride += ply_type_size(property.type);
+                }
+                if (!find_property(element, {"x"}, position_offset) || !find_property(element, {"y"}, position_offset) ||
+                    !find_property(element, {"z"}, position_offset))
+                {
+                    spdlog::error("{}: vertex element has no x, y and z", path);
+                    return nullptr;
+                }
+                if (element.count > UINT32_MAX || (stride > 0 && static_cast<std::size_t>(end - p) / stride < element.count))
+                {
+                    spdlog::error("{}: vertex data is truncated", path);
+                    return nullptr;
+                }
+                read_ply_vertices(element, p, swap, *mesh);
+                p += element.count * stride;
+                has_vertices = true;
+            }
+            else if (element.name == "face")
+            {
+                faces = &element;
+                face_data = p;
+            }
+            if (has_vertices && faces)
+                break;
+            if (element.name != "vertex")
+            {
+                p = skip_ply_element(element, p, end, swap);
+                if (!p)
+                {
+                    spdlog::error("{}: {} data is truncated", path, element.name);
+                    return nullptr;
+                }
+            }
+        }
+        if (!has_vertices || !faces)
+        {
+            spdlog::error("{}: PLY file has no vertex or no face element", path);
+            return nullptr;
+        }
+        if (!read_ply_faces(path, *faces, face_data, end, swap, *mesh))
+            return nullptr;
+        return mesh;
+    }
+
+    std::unique_ptr<MeshData> load(const std::string &path)
+    {
+        std::string extension = path.substr(std::min(path.rfind('.'), path.size()));
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (extension != ".obj" && extension != ".ply")
+        {
+            spdlog::error("{}: unknown mesh format, expected .obj or .ply", path);
+            return nullptr;
+        }
+
+        MappedFile file(path);
+        if (!file.is_open())
+        {
+            spdlog::error("{}: cannot open mesh file", path);
+            return nullptr;
+        }
+        if (extension == ".obj")
+            return load_obj(path, reinterpret_cast<const char *>(file.data()), file.size());
+        return load_ply(path, file.data(), file.size());
+    }
+}
@@ -8,18 +8,34 @@
 #include "rand_utils.h"
 
 #include "hittable.h"
-#include "hittable_list.h"
-#include "material.h"
-#include "bvh.h"
+#include "material_table.h"
+#include "ray_packet.h"
 
 #include <tbb/parallel_for.h>
 #include <tbb/blocked_range.h>
 #include <tbb/partitioner.h>
+#include <algorithm>
 #include <atomic>
 #include <cmath>
+#include <vector>
 #include "indicators/indicators.hpp"
 
-Color ray_color(const Ray &r, int depth, const Hittable &world, const Color &background)
+Color ray_color(const Ray &r, int depth, const Hittable &world, const MaterialTable &materials, const Color &background);
+
+// Color carried back along `r` from the surface it hit.
+Color shade(const Ray &r, const HitRecord &hit_record, int depth, const Hittable &world, const MaterialTable &materials, const Color &background)
+{
+    Ray scattered = Ray::uninitialized();
+    Color attenuation = Color::uninitialized();
+    Color emitted = hit_record.material ? materials.emitted(hit_record) : Color::black();
+    if (!hit_record.material || !materials.scatter(r, hit_record, attenuation, scattered))
+    {
+        return emitted;
+    }
+    return emitted + attenuation * ray_color(scattered, depth - 1, world, materials, background);
+}
+
+Color ray_color(const Ray &r, int depth, const Hittable &world, const MaterialTable &materials, const Color &background)
 {
     if (depth <= 0)
         return Color::black();
@@ -28,26 +44,16 @@ Color ray_color(const Ray &r, int depth, const Hittable &world, const Color &bac
     {
         return background;
     }
-
-    Ray scattered = Ray::uninitialized();
-    Color attenuation = Color::uninitialized();
-    Color emitted = hit_record.material ? hit_record.material->emitted(hit_record.u, hit_record.v, hit_record.point) : Color::black();
-    if (!hit_record.material || !hit_record.material->scatter(r, hit_record, attenuation, scattered))
-    {
-        return emitted;
-    }
-    return emitted + attenuation * ray_color(scattered, depth - 1, world, background);
+    return shade(r, hit_record, depth, world, materials, background);
 }
 
 void MyRenderer::render(
     const Camera &camera,
-    const HittableList &world,
+    const Hittable &world,
+    const MaterialTable &materials,
     const Color &background,
     std::uint8_t *buffer) const
 {
-    auto objects = world.objects;
-    BVH bvh(objects, camera.time1);
-
     indicators::ProgressBar progress_bar{
         indicators::option::BarWidth{50},
         indicators::option::Start{"["},
@@ -66,65 +72,82 @@ void MyRenderer::render(
     std::atomic<int> completed_rows{0};
     const int total_rows = camera.image_height;
 
-
-    const int sqrt_spp = static_cast<int>(std::sqrt(samples_per_pixel));
-    const int actual_samples = sqrt_spp * sqrt_spp;
-    const int remaining_samples = samples_per_pixel - actual_samples;
-    const FloatType inv_sqrt_spp = static_cast<FloatType>(1.0) / static_cast<FloatType>(sqrt_spp);
-    const FloatType inv_image_width = static_cast<FloatType>(1.0) / camera.image_width;
-    const FloatType inv_image_height = static_cast<FloatType>(1.0) / camera.image_height;
+    // Both paths take the same samples of a pixel, in the same order.
+    const PixelSampler sampler(camera, samples_per_pixel);
     const FloatType inv_samples_per_pixel = static_cast<FloatType>(1.0) / static_cast<FloatType>(samples_per_pixel);
 
+    if (packet_size > 0)
+    {
+        // A packet holds the rays of one sample index over a tile of 2x2, 4x2
+        // or 4x4 pixels, whose primary rays stay close together.
+        const int tile_width = packet_size >= 8 ? 4 : 2;
+        const int tile_height = packet_size / tile_width;
+
+        tbb::parallel_for(
+            tbb::blocked_range<int>(0, camera.image_height, 8),
+            [&](const tbb::blocked_range<int> &rows)
+            {
+                std::vector<Ray> rays(RayPacket::max_size, Ray::uninitialized());
+                std::vector<HitRecord> hit_records(RayPacket::max_size, HitRecord::uninitialized());
+                std::vector<Color> pixel_color_sums(RayPacket::max_size, Color::black());
+
+                for (int tile_j = rows.begin(); tile_j < rows.end(); tile_j += tile_height)
+                {
+                    const int tile_rows = std::min(tile_height, rows.end() - tile_j);
+                    for (int tile_i = 0; tile_i < camera.image_width; tile_i += tile_width)
+                    {
+                        const int tile_columns = std::min(tile_width, camera.image_width - tile_i);
+                        const int lanes = tile_rows * tile_columns;
+                        std::fill(pixel_color_sums.begin(), pixel_color_sums.end(), Color::black());
+
+                        for (int sample = 0; sample < samples_per_pixel && max_depth > 0; ++sample)
+                        {
+                            for (int l = 0; l < lanes; ++l)
+                                rays[l] = sampler.sample(tile_i + l % tile_columns, tile_j + l / tile_columns, sample);
+
+                            std::uint32_t hits = world.hit_packet(rays.data(), lanes, Interval(static_cast<FloatType>(0.001), infinity_f), hit_records.data());
+                            for (int l = 0; l < lanes; ++l)
+                            {
+                                if (hits & (1u << l))
+                                    pixel_color_sums[l] += shade(rays[l], hit_records[l], max_depth, world, materials, background);
+                                else
+                                    pixel_color_sums[l] += background;
+                            }
+                        }
+
+                        for (int l = 0; l < lanes; ++l)
+                        {
+                            const int i = tile_i + l % tile_columns;
+                            const int j = tile_j + l / tile_columns;
+                            auto pixel_color = Color::pow(pixel_color_sums[l] * inv_samples_per_pixel, gamma).to_uint8();
+                            buffer[3 * (j * camera.image_width + i) + 0] = pixel_color[0];
+                            buffer[3 * (j * camera.image_width + i) + 1] = pixel_color[1];
+                            buffer[3 * (j * camera.image_width + i) + 2] = pixel_color[2];
+                        }
+                    }
+
+                    int current_completed = completed_rows.fetch_add(tile_rows) + tile_rows;
+                    float progress = static_cast<float>(current_completed) / static_cast<float>(total_rows);
+                    progress_bar.set_progress(static_cast<size_t>(progress * 100));
+                }
+            },
+            tbb::static_partitioner());
+
+        progress_bar.mark_as_completed();
+        return;
+    }
+
     tbb::parallel_for(
         tbb::blocked_range<int>(0, camera.image_height, 8),
         [&](const tbb::blocked_range<int> &rows)
         {
             for (int j = rows.begin(); j != rows.end(); ++j)
             {
-                // Pre-calculate pixel row coordinate
-                const FloatType pixel_v_base = static_cast<FloatType>(1.0) - (static_cast<FloatType>(j) + static_cast<FloatType>(0.5)) * inv_image_height;
-                
                 for (int i = 0; i < camera.image_width; ++i)
                 {
                     Color pixel_color_sum = Color::black();
-
-                    // Pre-calculate pixel column coordinate
-                    const FloatType pixel_u_base = (static_cast<FloatType>(i) + static_cast<FloatType>(0.5)) * inv_image_width;
-                    
-                    // Sample from each stratum
-                    for (int stratum_j = 0; stratum_j < sqrt_spp; ++stratum_j)
-                    {
-                        const FloatType stratum_j_offset = static_cast<FloatType>(stratum_j) * inv_sqrt_spp - static_cast<FloatType>(0.5);
-                        
-                        for (int stratum_i = 0; stratum_i < sqrt_spp; ++stratum_i)
-                        {
-                            const FloatType stratum_i_offset = static_cast<FloatType>(stratum_i) * inv_sqrt_spp - static_cast<FloatType>(0.5);
-                            
-                            FloatType random_u = random_float();
-                            FloatType random_v = random_float();
-                            FloatType stratum_u = stratum_i_offset + random_u * inv_sqrt_spp;
-                            FloatType stratum_v = stratum_j_offset + random_v * inv_sqrt_spp;
-
-                            FloatType u = pixel_u_base + stratum_u * inv_image_width;
-                            FloatType v = pixel_v_base - stratum_v * inv_image_height; // flip v for image coordinates
-
-                            Ray r = camera.get_ray(u, v);
-                            pixel_color_sum += ray_color(r, max_depth, bvh, background);
-                        }
-                    }
-                    
-                    // Handle remaining samples if samples_per_pixel is not a perfect square
-                    for (int sample = 0; sample < remaining_samples; ++sample)
-                    {
-                        FloatType random_u = random_float() - static_cast<FloatType>(0.5);
-                        FloatType random_v = random_float() - static_cast<FloatType>(0.5);
-
-                        FloatType u = pixel_u_base + random_u * inv_image_width;
-                        FloatType v = pixel_v_base - random_v * inv_image_height; // flip v for image coordinates
-
-                        Ray r = camera.get_ray(u, v);
-                        pixel_color_sum += ray_color(r, max_depth, bvh, background);
-                    }
+                    for (int sample = 0; sample < samples_per_pixel; ++sample)
+                        pixel_color_sum += ray_color(sampler.sample(i, j, sample), max_depth, world, materials, background);
 
                     pixel_color_sum = pixel_color_sum * inv_samples_per_pixel;
 
@@ -4,7 +4,7 @@
 #include <thread>
 #include <chrono>
 
-FloatType random_float()
+static std::mt19937 &generator()
 {
     thread_local std::mt19937 generator(
         static_cast<unsigned int>(
@@ -12,8 +12,18 @@ FloatType random_float()
             static_cast<unsigned int>(std::chrono::high_resolution_clock::now().time_since_epoch().count())
         )
     );
+    return generator;
+}
+
+void seed_random(std::uint32_t seed)
+{
+    generator().seed(seed);
+}
+
+FloatType random_float()
+{
     thread_local std::uniform_real_distribution<FloatType> distribution(0.0, 1.0);
-    return distribution(generator);
+    return distribution(generator());
 }
 
 FloatType random_float(FloatType min, FloatType max)
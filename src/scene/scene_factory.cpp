@@ -1,7 +1,10 @@
 #include "scene/scene_factory.h"
 #include "primitives/sphere.h"
+#include "primitives/sphere_set.h"
 #include "primitives/quad.h"
+#include "primitives/box.h"
 #include "primitives/triangle.h"
+#include "primitives/triangle_mesh.h"
 #include "primitives/constant_medium.h"
 #include "instance.h"
 #include "math/math_utils.h"
@@ -23,6 +26,19 @@ static std::unique_ptr<Scene> random_scene(FloatType time0, FloatType time1)
     scene->world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, ground.get()));
     scene->materials.push_back(std::move(ground));
 
+    // Spheres that do not move share one set.
+    std::vector<Point3> centers;
+    std::vector<FloatType> radii;
+    std::vector<const Material *> sphere_materials;
+    auto add_sphere = [&](const Point3 &center, FloatType radius, const Material *material)
+    {
+        centers.push_back(center);
+        radii.push_back(radius);
+        sphere_materials.push_back(material);
+    };
+    // Moving spheres are instances of one small sphere, each with its own material.
+    auto small_sphere = std::make_shared<Sphere>(Point3(0, 0, 0), 0.2, nullptr);
+
     for (int a = -11; a < 11; a++)
     {
         for (int b = -11; b < 11; b++)
@@ -38,9 +54,8 @@ static std::unique_ptr<Scene> random_scene(FloatType time0, FloatType time1)
                     const Texture *tex_ptr = tex.get();
                     scene->textures.push_back(std::move(tex));
                     auto mat = std::make_unique<Lambertian>(tex_ptr);
-                    auto sphere = std::make_shared<Sphere>(center, 0.2, mat.get());
-                    auto transform = std::make_shared<Transform>(Mat4::identity(), Motion(Vec3(0, random_float(0, 0.5), 0)), time0);
-                    scene->world.add(std::make_shared<Instance>(sphere, transform));
+                    auto transform = std::make_shared<Transform>(Mat4::translation(center), Motion(Vec3(0, random_float(0, 0.5), 0)), time0);
+                    scene->world.add(std::make_shared<Instance>(small_sphere, transform, mat.get()));
                     scene->materials.push_back(std::move(mat));
                 }
                 else if (choose_mat < 0.95)
@@ -48,13 +63,13 @@ static std::unique_ptr<Scene> random_scene(FloatType time0, FloatType time1)
                     auto albedo = Color::random(0.5, 1);
                     auto fuzz = random_float(0, 0.5);
                     auto mat = std::make_unique<Metal>(albedo, fuzz);
-                    scene->world.add(std::make_shared<Sphere>(center, 0.2, mat.get()));
+                    add_sphere(center, 0.2, mat.get());
                     scene->materials.push_back(std::move(mat));
                 }
                 else
                 {
                     auto mat = std::make_unique<Dielectric>(1.5);
-                    scene->world.add(std::make_shared<Sphere>(center, 0.2, mat.get()));
+                    add_sphere(center, 0.2, mat.get());
                     scene->materials.push_back(std::move(mat));
                 }
             }
@@ -62,20 +77,22 @@ static std::unique_ptr<Scene> random_scene(FloatType time0, FloatType time1)
     }
 
     auto mat1 = std::make_unique<Dielectric>(1.5);
-    scene->world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, mat1.get()));
+    add_sphere(Point3(0, 1, 0), 1.0, mat1.get());
     scene->materials.push_back(std::move(mat1));
 
     auto tex2 = std::make_unique<SolidColorTexture>(Color(0.4, 0.2, 0.1));
     const Texture *tex2_ptr = tex2.get();
     scene->textures.push_back(std::move(tex2));
     auto mat2 = std::make_unique<Lambertian>(tex2_ptr);
-    scene->world.add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, mat2.get()));
+    add_sphere(Point3(-4, 1, 0), 1.0, mat2.get());
     scene->materials.push_back(std::move(mat2));
 
     auto mat3 = std::make_unique<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-    scene->world.add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, mat3.get()));
+    add_sphere(Point3(4, 1, 0), 1.0, mat3.get());
     scene->materials.push_back(std::move(mat3));
 
+    scene->world.add(std::make_shared<SphereSet>(centers, radii, sphere_materials));
+
     return scene;
 }
 
@@ -193,12 +210,10 @@ static std::unique_ptr<Scene> triangles_scene(FloatType time0, FloatType time1)
 
     {
         auto metal_mat = std::make_unique<Metal>(Color(0.8, 0.8, 0.9), 0.1);
-        Point3 a(-1, -2, 1), b(1, -2, 1), c(1, -2, 3), d(-1, -2, 3);
-        Point3 apex(0, 0, 2);
-        scene->world.add(std::make_shared<Triangle>(a, b, apex, metal_mat.get()));
-        scene->world.add(std::make_shared<Triangle>(b, c, apex, metal_mat.get()));
-        scene->world.add(std::make_shared<Triangle>(c, d, apex, metal_mat.get()));
-        scene->world.add(std::make_shared<Triangle>(d, a, apex, metal_mat.get()));
+        // Four sides around a shared apex (vertex 4).
+        std::vector<Point3> positions = {Point3(-1, -2, 1), Point3(1, -2, 1), Point3(1, -2, 3), Point3(-1, -2, 3), Point3(0, 0, 2)};
+        std::vector<std::uint32_t> indices = {0, 1, 4, 1, 2, 4, 2, 3, 4, 3, 0, 4};
+        scene->world.add(std::make_shared<TriangleMesh>(std::move(positions), std::move(indices), metal_mat.get()));
         scene->materials.push_back(std::move(metal_mat));
     }
 
@@ -220,21 +235,6 @@ static std::unique_ptr<Scene> triangles_scene(FloatType time0, FloatType time1)
     return scene;
 }
 
-static std::shared_ptr<Hittable> make_box(const Point3 &a, const Point3 &b, const Material *mat)
-{
-    Point3 min(std::fmin(a.x, b.x), std::fmin(a.y, b.y), std::fmin(a.z, b.z));
-    Point3 max(std::fmax(a.x, b.x), std::fmax(a.y, b.y), std::fmax(a.z, b.z));
-    auto sides = std::make_shared<HittableList>();
-    sides->add(std::make_shared<Quad>(Point3(min.x, min.y, max.z), Vec3(max.x - min.x, 0, 0), Vec3(0, max.y - min.y, 0), mat));
-    sides->add(std::make_shared<Quad>(Point3(min.x, min.y, min.z), Vec3(max.x - min.x, 0, 0), Vec3(0, max.y - min.y, 0), mat));
-    sides->add(std::make_shared<Quad>(Point3(min.x, max.y, min.z), Vec3(max.x - min.x, 0, 0), Vec3(0, 0, max.z - min.z), mat));
-    sides->add(std::make_shared<Quad>(Point3(min.x, min.y, min.z), Vec3(0, 0, max.z - min.z), Vec3(0, max.y - min.y, 0), mat));
-    sides->add(std::make_shared<Quad>(Point3(max.x, min.y, min.z), Vec3(0, 0, max.z - min.z), Vec3(0, max.y - min.y, 0), mat));
-    // Bottom face (y = min.y)
-    sides->add(std::make_shared<Quad>(Point3(min.x, min.y, min.z), Vec3(max.x - min.x, 0, 0), Vec3(0, 0, max.z - min.z), mat));
-    return sides;
-}
-
 static std::unique_ptr<Scene> cornell_box_scene(FloatType time0, FloatType time1)
 {
     auto scene = std::make_unique<Scene>();
@@ -267,8 +267,8 @@ static std::unique_ptr<Scene> cornell_box_scene(FloatType time0, FloatType time1
     scene->world.add(std::make_shared<Quad>(Point3(555, 555, 555), Vec3(-555, 0, 0), Vec3(0, 0, -555), white.get()));
     scene->world.add(std::make_shared<Quad>(Point3(0, 0, 555), Vec3(555, 0, 0), Vec3(0, 555, 0), white.get()));
 
-    auto box1 = make_box(Point3(0, 0, 0), Point3(165, 330, 165), white.get());
-    auto box2 = make_box(Point3(0, 0, 0), Point3(165, 165, 165), white.get());
+    auto box1 = std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white.get());
+    auto box2 = std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white.get());
 
     FloatType angle1 = MathUtils::degrees_to_radians(15);
     Mat3 rot1 = Mat3::identity();
@@ -324,8 +324,8 @@ static std::unique_ptr<Scene> cornell_smoke_scene(FloatType time0, FloatType tim
     scene->world.add(std::make_shared<Quad>(Point3(0, 0, 0), Vec3(555, 0, 0), Vec3(0, 0, 555), white.get()));
     scene->world.add(std::make_shared<Quad>(Point3(0, 0, 555), Vec3(555, 0, 0), Vec3(0, 555, 0), white.get()));
 
-    auto box1 = make_box(Point3(0, 0, 0), Point3(165, 330, 165), white.get());
-    auto box2 = make_box(Point3(0, 0, 0), Point3(165, 165, 165), white.get());
+    auto box1 = std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white.get());
+    auto box2 = std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white.get());
 
     FloatType angle1 = MathUtils::degrees_to_radians(15);
     Mat3 rot1 = Mat3::identity();
@@ -391,7 +391,7 @@ static std::unique_ptr<Scene> final_scene(FloatType time0, FloatType time1)
             FloatType x1 = x0 + w;
             FloatType y1 = random_float(1.0, 101.0);
             FloatType z1 = z0 + w;
-            scene->world.add(make_box(Point3(x0, y0, z0), Point3(x1, y1, z1), ground_mat));
+            scene->world.add(std::make_shared<Box>(Point3(x0, y0, z0), Point3(x1, y1, z1), ground_mat));
         }
     }
 
@@ -463,20 +463,17 @@ static std::unique_ptr<Scene> final_scene(FloatType time0, FloatType time1)
     const Material *white_mat = white.get();
     scene->materials.push_back(std::move(white));
 
-    std::vector<std::shared_ptr<Hittable>> cluster_objects;
     int ns = 1000;
+    std::vector<Point3> cluster_centers;
     for (int j = 0; j < ns; ++j)
-    {
-        Point3 center(random_float(0, 165), random_float(0, 165), random_float(0, 165));
-        cluster_objects.push_back(std::make_shared<Sphere>(center, 10, white_mat));
-    }
-    auto cluster_bvh = std::make_shared<BVH>(cluster_objects, time1);
+        cluster_centers.push_back(Point3(random_float(0, 165), random_float(0, 165), random_float(0, 165)));
+    auto cluster = std::make_shared<SphereSet>(cluster_centers, std::vector<FloatType>(ns, 10), std::vector<const Material *>(ns, white_mat));
     FloatType angle = MathUtils::degrees_to_radians(15);
     Mat3 rot = Mat3::identity();
     rot.m[0][0] = std::cos(angle); rot.m[0][2] = std::sin(angle);
     rot.m[2][0] = -std::sin(angle); rot.m[2][2] = std::cos(angle);
     auto cluster_t = std::make_shared<Transform>(Mat4::TRS(Vec3(-100, 270, 395), rot, Vec3(1, 1, 1)));
-    scene->world.add(std::make_shared<Instance>(cluster_bvh, cluster_t));
+    scene->world.add(std::make_shared<Instance>(cluster, cluster_t));
 
     scene->materials.push_back(std::move(glass));
     scene->materials.push_back(std::move(metal));
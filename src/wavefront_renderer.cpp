@@ -0,0 +1,205 @@
+#include "wavefront_renderer.h"
+
+#include "ray.h"
+#include "color.h"
+#include "camera.h"
+#include "common.h"
+
+#include "hittable.h"
+#include "material_table.h"
+#include "ray_packet.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/partitioner.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "indicators/indicators.hpp"
+
+namespace
+{
+    constexpr int material_kind_count = static_cast<int>(MaterialKind::Other) + 1;
+
+    // Paths at one bounce, one array per field. `pixel` indexes the color
+    // sums of the row block being rendered.
+    struct PathQueue
+    {
+        std::vector<Ray> rays;
+        std::vector<Color> throughput;
+        std::vector<std::uint32_t> pixel;
+
+        size_t size() const { return rays.size(); }
+
+        void clear()
+        {
+            rays.clear();
+            throughput.clear();
+            pixel.clear();
+        }
+
+        void push(const Ray &ray, const Color &path_throughput, std::uint32_t path_pixel)
+        {
+            rays.push_back(ray);
+            throughput.push_back(path_throughput);
+            pixel.push_back(path_pixel);
+        }
+    };
+
+    // Shades the hits listed in `bin`, whose material table entries are all
+    // of kind `Kind`. The kind is a template argument, so the loop body is
+    // the shading of that one kind with no dispatch at all; a Lambertian
+    // with a constant albedo reads it from its entry. Scattered rays go to
+    // `next` unless this was the last bounce.
+    template <MaterialKind Kind>
+    void shade_bin(const std::vector<std::uint32_t> &bin, const MaterialTable &materials, const PathQueue &queue,
+                   const std::vector<HitRecord> &hit_records, bool last_bounce, PathQueue &next, std::vector<Color> &pixel_color_sums)
+    {
+        for (std::uint32_t index : bin)
+        {
+            const HitRecord &hit_record = hit_records[index];
+            const Color &throughput = queue.throughput[index];
+            if constexpr (Kind == MaterialKind::Other)
+            {
+                // Also holds the materials missing from the table.
+                pixel_color_sums[queue.pixel[index]] += throughput * materials.emitted(hit_record);
+                if (last_bounce)
+                    continue;
+                Ray scattered = Ray::uninitialized();
+                Color attenuation = Color::uninitialized();
+                if (materials.scatter(queue.rays[index], hit_record, attenuation, scattered))
+                    next.push(scattered, throughput * attenuation, queue.pixel[index]);
+            }
+            else
+            {
+                const MaterialTable::Entry &entry = materials.entries[hit_record.material->table_index];
+                if constexpr (Kind == MaterialKind::DiffuseLight)
+                    pixel_color_sums[queue.pixel[index]] += throughput * MaterialTable::emitted_as<Kind>(entry, hit_record);
+                if (last_bounce)
+                    continue;
+                Ray scattered = Ray::uninitialized();
+                Color attenuation = Color::uninitialized();
+                if (MaterialTable::scatter_as<Kind>(entry, queue.rays[index], hit_record, attenuation, scattered))
+                    next.push(scattered, throughput * attenuation, queue.pixel[index]);
+            }
+        }
+    }
+}
+
+void WavefrontRenderer::render(
+    const Camera &camera,
+    const Hittable &world,
+    const MaterialTable &materials,
+    const Color &background,
+    std::uint8_t *buffer) const
+{
+    indicators::ProgressBar progress_bar{
+        indicators::option::BarWidth{50},
+        indicators::option::Start{"["},
+        indicators::option::Fill{"="},
+        indicators::option::Lead{">"},
+        indicators::option::Remainder{"-"},
+        indicators::option::End{"]"},
+        indicators::option::PrefixText{"Rendering "},
+        indicators::option::PostfixText{" Complete"},
+        indicators::option::ForegroundColor{indicators::Color::green},
+        indicators::option::ShowPercentage{true},
+        indicators::option::ShowElapsedTime{true},
+        indicators::option::ShowRemainingTime{true},
+        indicators::option::FontStyles{std::vector<indicators::FontStyle>{indicators::FontStyle::bold}}};
+
+    std::atomic<int> completed_rows{0};
+    const int total_rows = camera.image_height;
+
+    const PixelSampler sampler(camera, samples_per_pixel);
+    const FloatType inv_samples_per_pixel = static_cast<FloatType>(1.0) / static_cast<FloatType>(samples_per_pixel);
+    const Interval t_range(static_cast<FloatType>(0.001), infinity_f);
+    // Every pixel of a batch takes all its samples in that batch.
+    const int batch_pixels = std::max(1, batch_size / std::max(1, samples_per_pixel));
+
+    tbb::parallel_for(
+        tbb::blocked_range<int>(0, camera.image_height, 8),
+        [&](const tbb::blocked_range<int> &rows)
+        {
+            const int first_pixel = rows.begin() * camera.image_width;
+            const int pixel_count = static_cast<int>(rows.size()) * camera.image_width;
+            std::vector<Color> pixel_color_sums(pixel_count, Color::black());
+
+            PathQueue queue;
+            PathQueue next;
+            std::vector<HitRecord> hit_records;
+            std::array<std::vector<std::uint32_t>, material_kind_count> bins;
+
+            for (int batch_begin = 0; batch_begin < pixel_count && max_depth > 0; batch_begin += batch_pixels)
+            {
+                const int batch_end = std::min(pixel_count, batch_begin + batch_pixels);
+
+                // Generate: sample-major, so neighbouring queue entries are
+                // primary rays of neighbouring pixels and trace well together.
+                queue.clear();
+                for (int sample = 0; sample < samples_per_pixel; ++sample)
+                {
+                    for (int p = batch_begin; p < batch_end; ++p)
+                    {
+                        const int pixel = first_pixel + p;
+                        queue.push(sampler.sample(pixel % camera.image_width, pixel / camera.image_width, sample),
+                                   Color(1.0, 1.0, 1.0), static_cast<std::uint32_t>(p));
+                    }
+                }
+
+                for (int depth = max_depth; depth > 0 && queue.size() > 0; --depth)
+                {
+                    // Intersect the whole queue; misses pick up the
+                    // background. Only primary rays are coherent enough to
+                    // share a traversal, bounced rays are traced one by one.
+                    hit_records.resize(queue.size(), HitRecord::uninitialized());
+                    for (auto &bin : bins)
+                        bin.clear();
+                    const int packet_size = depth == max_depth ? RayPacket::max_size : 1;
+                    for (size_t begin = 0; begin < queue.size(); begin += packet_size)
+                    {
+                        const int count = static_cast<int>(std::min<size_t>(packet_size, queue.size() - begin));
+                        std::uint32_t hits = count == 1 ? world.hit(queue.rays[begin], t_range, hit_records[begin])
+                                                        : world.hit_packet(&queue.rays[begin], count, t_range, &hit_records[begin]);
+                        for (int l = 0; l < count; ++l)
+                        {
+                            const std::uint32_t index = static_cast<std::uint32_t>(begin) + l;
+                            if (!(hits & (1u << l)))
+                                pixel_color_sums[queue.pixel[index]] += queue.throughput[index] * background;
+                            else if (hit_records[index].material)
+                                bins[static_cast<int>(materials.kind_of(*hit_records[index].material))].push_back(index);
+                        }
+                    }
+
+                    // Shade one material type at a time into the compacted
+                    // queue of the next bounce.
+                    const bool last_bounce = depth == 1;
+                    next.clear();
+                    shade_bin<MaterialKind::Lambertian>(bins[static_cast<int>(MaterialKind::Lambertian)], materials, queue, hit_records, last_bounce, next, pixel_color_sums);
+                    shade_bin<MaterialKind::Metal>(bins[static_cast<int>(MaterialKind::Metal)], materials, queue, hit_records, last_bounce, next, pixel_color_sums);
+                    shade_bin<MaterialKind::Dielectric>(bins[static_cast<int>(MaterialKind::Dielectric)], materials, queue, hit_records, last_bounce, next, pixel_color_sums);
+                    shade_bin<MaterialKind::DiffuseLight>(bins[static_cast<int>(MaterialKind::DiffuseLight)], materials, queue, hit_records, last_bounce, next, pixel_color_sums);
+                    shade_bin<MaterialKind::Isotropic>(bins[static_cast<int>(MaterialKind::Isotropic)], materials, queue, hit_records, last_bounce, next, pixel_color_sums);
+                    shade_bin<MaterialKind::Other>(bins[static_cast<int>(MaterialKind::Other)], materials, queue, hit_records, last_bounce, next, pixel_color_sums);
+                    std::swap(queue, next);
+                }
+            }
+
+            for (int p = 0; p < pixel_count; ++p)
+            {
+                auto pixel_color = Color::pow(pixel_color_sums[p] * inv_samples_per_pixel, gamma).to_uint8();
+                buffer[3 * (first_pixel + p) + 0] = pixel_color[0];
+                buffer[3 * (first_pixel + p) + 1] = pixel_color[1];
+                buffer[3 * (first_pixel + p) + 2] = pixel_color[2];
+            }
+
+            int current_completed = completed_rows.fetch_add(static_cast<int>(rows.size())) + static_cast<int>(rows.size());
+            float progress = static_cast<float>(current_completed) / static_cast<float>(total_rows);
+            progress_bar.set_progress(static_cast<size_t>(progress * 100));
+        },
+        tbb::static_partitioner());
+
+    progress_bar.mark_as_completed();
+}